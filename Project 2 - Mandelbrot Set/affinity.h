@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+Thread pinning.
+With a policy other than AFFINITY_NONE, thread i of a parallel region is
+pinned to the i-th CPU of an order derived from the CPU topology in sysfs.
+Together with first-touch initialization (every worker writes its own part
+of data first, so the pages are placed on its NUMA node), threads keep
+working on local memory.
+*/
+
+enum Affinity {
+    AFFINITY_NONE,    // leave placement to the OS
+    AFFINITY_COMPACT, // fill one socket, core by core, before the next
+    AFFINITY_SCATTER  // spread threads over the sockets round-robin
+};
+
+Affinity affinity = AFFINITY_NONE;
+
+const char* affinity_name(Affinity policy) {
+    switch (policy) {
+        case AFFINITY_COMPACT: return "compact";
+        case AFFINITY_SCATTER: return "scatter";
+        default: return "none";
+    }
+}
+
+Affinity parse_affinity(const char* name) {
+    if (strcmp(name, "compact") == 0) return AFFINITY_COMPACT;
+    if (strcmp(name, "scatter") == 0) return AFFINITY_SCATTER;
+    return AFFINITY_NONE;
+}
+
+int read_topology(int cpu, const char* name, int fallback) {
+    /* a value of /sys/devices/system/cpu/cpu<cpu>/topology, fallback if missing */
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE* f = fopen(path, "r");
+    int value;
+    if (f == nullptr) return fallback;
+    if (fscanf(f, "%d", &value) != 1) value = fallback;
+    fclose(f);
+    return value;
+}
+
+std::vector<int> affinity_order(Affinity policy) {
+    /*
+    The CPUs this process may run on, in the order threads are pinned to
+    them. Sockets (physical packages) stand in for NUMA nodes. Both orders
+    use all physical cores before their hyper-thread siblings.
+    */
+    struct Cpu {
+        int package, core, sibling, id;
+    };
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<Cpu> cpus;
+    for (int id = 0; id < CPU_SETSIZE; id++) {
+        if (!CPU_ISSET(id, &allowed)) continue;
+        Cpu cpu = {read_topology(id, "physical_package_id", 0), read_topology(id, "core_id", id),
+                   0, id};
+        cpus.push_back(cpu);
+    }
+
+    // number the hyper-threads of each core 0, 1, ...
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+        if (a.package != b.package) return a.package < b.package;
+        if (a.core != b.core) return a.core < b.core;
+        return a.id < b.id;
+    });
+    for (size_t i = 1; i < cpus.size(); i++)
+        if (cpus[i].package == cpus[i - 1].package && cpus[i].core == cpus[i - 1].core)
+            cpus[i].sibling = cpus[i - 1].sibling + 1;
+
+    // rank of each CPU within its package: physical cores first
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+        if (a.package != b.package) return a.package < b.package;
+        if (a.sibling != b.sibling) return a.sibling < b.sibling;
+        return a.core < b.core;
+    });
+    std::vector<int> rank(cpus.size(), 0);
+    for (size_t i = 1; i < cpus.size(); i++)
+        rank[i] = cpus[i].package == cpus[i - 1].package ? rank[i - 1] + 1 : 0;
+
+    std::vector<size_t> order(cpus.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    if (policy == AFFINITY_SCATTER) {
+        // the first CPU of every package, then the second, ...
+        std::stable_sort(order.begin(), order.end(), [&rank](size_t a, size_t b) {
+            return rank[a] < rank[b];
+        });
+    }
+
+    std::vector<int> ids;
+    for (size_t i = 0; i < order.size(); i++) ids.push_back(cpus[order[i]].id);
+    return ids;
+}
+
+void pin_thread(int thread) {
+    /* pin the calling thread, number thread of its parallel region, to its CPU */
+    if (affinity == AFFINITY_NONE) return;
+
+    static std::vector<int> order = affinity_order(affinity);
+    if (order.empty()) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(order[thread % order.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "asg2.h"
+
+/*
+Zoom animation support: keyframes, frame encoding and a background writer
+that encodes and writes finished frames while the next ones are computed.
+*/
+
+/* frames with fewer pixels than this are rendered whole by a single worker */
+const int FRAME_TILE_THRESHOLD = 512 * 512;
+
+/* a point of the zoom path */
+struct Keyframe {
+    DoubleDouble center_real, center_imag;
+    double scale;
+};
+
+std::vector<Keyframe> load_keyframes(const std::string& path) {
+    /*
+    Read keyframes, one "<center real> <center imag> <scale>" per line.
+    Empty lines and lines starting with '#' are ignored.
+    */
+    std::vector<Keyframe> keyframes;
+    std::ifstream f(path.c_str());
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::string real, imag;
+        Keyframe key;
+        if (!(ss >> real >> imag >> key.scale)) continue;
+        key.center_real = dd_from_string(real.c_str());
+        key.center_imag = dd_from_string(imag.c_str());
+        keyframes.push_back(key);
+    }
+    return keyframes;
+}
+
+Viewport animation_viewport(const std::vector<Keyframe>& keyframes, int frame) {
+    /*
+    Viewport of a frame: the center moves linearly between keyframes and the
+    scale changes geometrically, so a zoom runs at a constant speed.
+    Precision and engine settings are taken from the global view.
+    */
+    Viewport vp = view;
+    if (keyframes.empty()) return vp;
+
+    const int segments = (int) keyframes.size() - 1;
+    double t = n_frames > 1 ? (double) frame / (n_frames - 1) * segments : 0.0;
+    int seg = std::min((int) t, std::max(segments - 1, 0));
+    t = segments > 0 ? t - seg : 0.0;
+
+    const Keyframe& a = keyframes[seg];
+    const Keyframe& b = keyframes[std::min(seg + 1, segments)];
+    vp.center_real = a.center_real + (b.center_real - a.center_real) * DoubleDouble(t);
+    vp.center_imag = a.center_imag + (b.center_imag - a.center_imag) * DoubleDouble(t);
+    vp.scale = a.scale * std::pow(b.scale / a.scale, t);
+    return vp;
+}
+
+/* a buffer handed from the compute side to the writer thread */
+struct Frame {
+    std::vector<Point> points;
+    int index; // frame (or band) number
+    int count; // number of valid points
+};
+
+/* encode and write one frame, runs on the writer thread */
+typedef void (*FrameWriteFunc)(const Frame& frame);
+
+class FrameWriter {
+    /*
+    A bounded ring of frame buffers and a background thread that writes them
+    in submission order. Compute threads acquire() a free buffer, fill it and
+    submit() it; acquire() blocks while all buffers are still being written.
+    */
+public:
+    FrameWriter(int n_slots, int slot_size, FrameWriteFunc write) :
+        slots(n_slots), write(write), done(false) {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].points.resize(slot_size);
+            init_points(slots[i].points.data(), 0, slot_size);
+            free_slots.push_back(&slots[i]);
+        }
+        pthread_create(&thread, nullptr, run, this);
+    }
+
+    ~FrameWriter() {
+        finish();
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+
+    Frame* acquire() {
+        pthread_mutex_lock(&mutex);
+        while (free_slots.empty())
+            pthread_cond_wait(&cond, &mutex);
+        Frame* frame = free_slots.front();
+        free_slots.pop_front();
+        pthread_mutex_unlock(&mutex);
+        return frame;
+    }
+
+    void submit(Frame* frame) {
+        pthread_mutex_lock(&mutex);
+        queue.push_back(frame);
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void finish() {
+        /* write everything that is queued and stop the writer thread */
+        pthread_mutex_lock(&mutex);
+        if (done) {
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+        done = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(thread, nullptr);
+    }
+
+private:
+    static void* run(void* arg) {
+        FrameWriter* self = static_cast<FrameWriter*>(arg);
+        pthread_mutex_lock(&self->mutex);
+        while (true) {
+            while (self->queue.empty() && !self->done)
+                pthread_cond_wait(&self->cond, &self->mutex);
+            if (self->queue.empty()) break;
+            Frame* frame = self->queue.front();
+            self->queue.pop_front();
+
+            pthread_mutex_unlock(&self->mutex);
+            self->write(*frame);
+            pthread_mutex_lock(&self->mutex);
+
+            self->free_slots.push_back(frame);
+            pthread_cond_broadcast(&self->cond);
+        }
+        pthread_mutex_unlock(&self->mutex);
+        return nullptr;
+    }
+
+    std::vector<Frame> slots;
+    std::deque<Frame*> free_slots, queue;
+    FrameWriteFunc write;
+    bool done;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+inline unsigned char to_gray(float color) {
+    /* same shading as plot(): points in the set are black */
+    return (unsigned char) (255.0f * (1.0f - color) + 0.5f);
+}
+
+void encode_rows(const Point* points, int y_begin, int y_end, unsigned char* out) {
+    /*
+    Convert rows [y_begin, y_end) of a column major frame to top-down, row
+    major 8-bit gray pixels, the layout of PGM files.
+    */
+    for (int y = y_end - 1; y >= y_begin; y--)
+        for (int x = 0; x < X_RESN; x++)
+            *out++ = to_gray(points[x * Y_RESN + y].color);
+}
+
+void write_frame_pgm(const Frame& frame) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s_%05d.pgm", output_prefix.c_str(), frame.index);
+    std::vector<unsigned char> pixels(total_size);
+    encode_rows(frame.points.data(), 0, Y_RESN, pixels.data());
+
+    FILE* f = fopen(path, "wb");
+    if (f == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return;
+    }
+    fprintf(f, "P5\n%d %d\n255\n", X_RESN, Y_RESN);
+    fwrite(pixels.data(), 1, pixels.size(), f);
+    fclose(f);
+}
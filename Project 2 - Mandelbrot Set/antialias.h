@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "asg2.h"
+
+/*
+Adaptive anti-aliasing.
+After the base render, a pixel whose iteration count differs from one of its
+neighbours' by more than aa_threshold lies on an edge, either of the set or
+of a color band. Only those pixels are rendered again with aa_samples x
+aa_samples sub-pixel samples and take their average color; flat areas, which
+are most of the image, would look the same after supersampling anyway.
+*/
+
+/* edge pixels are handed out to threads in chunks of this size */
+const int AA_CHUNK = 64;
+
+inline int iterations_of(const Point& p) {
+    /* undo color = k / max_iteration */
+    return (int) (p.color * max_iteration + 0.5f);
+}
+
+std::vector<Point> find_edges(const Point* frame) {
+    /*
+    Collect copies of the edge pixels of a whole (column major) frame, in
+    index order. Copies keep the base colors of the frame intact until all
+    edges are found.
+    */
+    std::vector<Point> edges;
+    for (int x = 0; x < X_RESN; x++) {
+        const Point* column = frame + x * Y_RESN;
+        for (int y = 0; y < Y_RESN; y++) {
+            const int k = iterations_of(column[y]);
+            const bool edge =
+                (x > 0 && abs(iterations_of(column[y - Y_RESN]) - k) > aa_threshold) ||
+                (x < X_RESN - 1 && abs(iterations_of(column[y + Y_RESN]) - k) > aa_threshold) ||
+                (y > 0 && abs(iterations_of(column[y - 1]) - k) > aa_threshold) ||
+                (y < Y_RESN - 1 && abs(iterations_of(column[y + 1]) - k) > aa_threshold);
+            if (edge) edges.push_back(column[y]);
+        }
+    }
+    return edges;
+}
+
+void store_edges(Point* frame, const Point* edges, int count) {
+    /* write supersampled colors back to their pixels */
+    for (int i = 0; i < count; i++)
+        frame[edges[i].x * Y_RESN + edges[i].y].color = edges[i].color;
+}
+
+inline double subpixel_offset(int i) {
+    /* samples sit at the centers of an aa_samples x aa_samples grid over the pixel */
+    return (i + 0.5) / aa_samples - 0.5;
+}
+
+template <typename T>
+inline Compl<T> subpixel_to_c(const Point& p, int i, int j, const Viewport& vp) {
+    /* the pixel of pixel_to_c() at (x + dx, y + dy) for sample (i, j) */
+    const T half_x = (T) (X_RESN / 2), half_y = (T) (Y_RESN / 2);
+    Compl<T> pixel;
+    pixel.real = ((T) p.x + (T) subpixel_offset(i) - half_x) / half_x * (T) vp.scale +
+                 scalar_cast<T>(vp.center_real);
+    pixel.imag = ((T) p.y + (T) subpixel_offset(j) - half_y) / half_y *
+                     (T) (vp.scale * vp.aspect) + scalar_cast<T>(vp.center_imag);
+    return pixel;
+}
+
+template <typename F, typename T>
+void supersample_block(Point* begin, Point* end, const Viewport& vp) {
+    /*
+    The samples of all pixels, pixel after pixel, are iterated LANES at a
+    time by iterate_lanes(), as in compute_lanes(); a group of lanes may span
+    two pixels. Double-double samples go one after another.
+    */
+    const int samples = aa_samples * aa_samples;
+    const long count = end - begin;
+    std::vector<long> totals(count, 0);
+
+    if (!lane_batched<T>::value) {
+        for (long p = 0; p < count; p++)
+            for (int s = 0; s < samples; s++)
+                totals[p] += escape_time<F>(
+                    subpixel_to_c<T>(begin[p], s / aa_samples, s % aa_samples, vp), vp);
+    }
+    else {
+        for (long first = 0; first < count * samples; first += LANES) {
+            const int n = (int) std::min<long>(LANES, count * samples - first);
+            Lanes<T> lanes;
+
+            for (int l = 0; l < LANES; l++) {
+                const long sample = first + l;
+                Compl<T> z, c;
+                z.real = z.imag = c.real = c.imag = T(0.0);
+                if (l < n)
+                    F::start(subpixel_to_c<T>(begin[sample / samples],
+                                              sample % samples / aa_samples,
+                                              sample % aa_samples, vp),
+                             vp, z, c);
+                lanes.z_real[l] = z.real;
+                lanes.z_imag[l] = z.imag;
+                lanes.c_real[l] = c.real;
+                lanes.c_imag[l] = c.imag;
+                lanes.k[l] = 0;
+                lanes.alive[l] = l < n;
+            }
+
+            iterate_lanes<F>(lanes, 0);
+
+            for (int l = 0; l < n; l++) totals[(first + l) / samples] += lanes.k[l];
+        }
+    }
+
+    for (long p = 0; p < count; p++)
+        begin[p].color = (float) ((double) totals[p] / samples / max_iteration);
+}
+
+template <typename T>
+void supersample_block_perturbed(Point* begin, Point* end, const Viewport& vp) {
+    /* same as supersample_block(), samples are offsets from the reference */
+    const int samples = aa_samples * aa_samples;
+
+    for (Point* p = begin; p != end; p++) {
+        long total = 0;
+        for (int i = 0; i < aa_samples; i++) {
+            for (int j = 0; j < aa_samples; j++) {
+                Compl<T> dc;
+                dc.real = (T) (((double) p->x + subpixel_offset(i) - X_RESN / 2) /
+                                   (X_RESN / 2) * vp.scale - vp.reference_real);
+                dc.imag = (T) (((double) p->y + subpixel_offset(j) - Y_RESN / 2) /
+                                   (Y_RESN / 2) * vp.scale * vp.aspect - vp.reference_imag);
+                total += perturbed_escape_time(vp.reference, dc);
+            }
+        }
+        p->color = (float) ((double) total / samples / max_iteration);
+    }
+}
+
+void supersample_block(Point* begin, Point* end, const Viewport& vp) {
+    /* same dispatch as compute_block() */
+    if (vp.selected_engine == ENGINE_PERTURBATION) {
+        if (vp.selected_precision == PRECISION_FLOAT)
+            supersample_block_perturbed<float>(begin, end, vp);
+        else
+            supersample_block_perturbed<double>(begin, end, vp);
+        return;
+    }
+
+    with_formula(vp, [&](auto formula) {
+        typedef decltype(formula) F;
+        switch (vp.selected_precision) {
+            case PRECISION_DOUBLE: supersample_block<F, double>(begin, end, vp); break;
+            case PRECISION_DOUBLE_DOUBLE:
+                supersample_block<F, DoubleDouble>(begin, end, vp);
+                break;
+            default: supersample_block<F, float>(begin, end, vp); break;
+        }
+    });
+}
+
+void antialias(Point* frame, const Viewport& vp) {
+    /* the whole pass on a single thread, for frames rendered by one worker */
+    if (aa_samples <= 1) return;
+    std::vector<Point> edges = find_edges(frame);
+    supersample_block(edges.data(), edges.data() + edges.size(), vp);
+    store_edges(frame, edges.data(), (int) edges.size());
+}
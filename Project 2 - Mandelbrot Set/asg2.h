@@ -1,3 +1,5 @@
+#pragma once
+
 // #define GUI
 
 #ifdef GUI
@@ -8,14 +10,25 @@
 
 #endif
 
+#include <algorithm>
+#include <cfloat>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "affinity.h"
+#include "double_double.h"
 
 
 /* define a struct called Compl to store information of a complex number*/
-typedef struct complextype {
-    float real, imag;
-} Compl;
+template <typename T>
+struct Compl {
+    T real, imag;
+};
 
 /* define a struct called Point to store information of each point */
 typedef struct pointtype {
@@ -34,12 +47,124 @@ int X_RESN, Y_RESN, total_size, max_iteration;
 /* to store all the points, it will be initialized later */
 Point* data;
 
+/*
+scalar type used by the kernel, PRECISION_AUTO picks the cheapest one that can
+still resolve neighbouring pixels of the current frame
+*/
+enum Precision {
+    PRECISION_AUTO,
+    PRECISION_FLOAT,
+    PRECISION_DOUBLE,
+    PRECISION_DOUBLE_DOUBLE
+};
+
+/*
+how a pixel is iterated: ENGINE_DIRECT runs z = z^2 + c in the selected
+precision, ENGINE_PERTURBATION follows one high precision reference orbit and
+iterates every pixel as a low precision delta from it
+*/
+enum Engine {
+    ENGINE_AUTO,
+    ENGINE_DIRECT,
+    ENGINE_PERTURBATION
+};
+
+/* the escape-time fractal to render, see the formula policies below */
+enum Formula {
+    FORMULA_MANDELBROT,
+    FORMULA_JULIA,
+    FORMULA_BURNING_SHIP,
+    FORMULA_MULTIBROT3,
+    FORMULA_MULTIBROT4,
+    FORMULA_MULTIBROT5
+};
+
+/* the part of the complex plane that is mapped onto [0, X_RESN] x [0, Y_RESN] */
+struct Viewport {
+    DoubleDouble center_real, center_imag;
+    double scale;  // half width of the view along the real axis
+    double aspect; // height / width of the view in the complex plane
+    Precision precision; // requested precision
+    Engine engine;       // requested engine
+    Formula formula;
+    Compl<double> julia; // the constant c of FORMULA_JULIA
+
+    /* the following are derived per frame by setup_viewport() */
+    Precision selected_precision;
+    Engine selected_engine;
+    double reference_real, reference_imag; // reference point, relative to the center
+    std::vector<Compl<double> > reference; // reference orbit Z_0, Z_1, ...
+};
+
+/* the default viewport is [-1, 1] x [-1, 1] */
+Viewport view = {DoubleDouble(0.0), DoubleDouble(0.0), 1.0, 1.0, PRECISION_AUTO,
+                 ENGINE_AUTO, FORMULA_MANDELBROT, {-0.8, 0.156}, PRECISION_FLOAT,
+                 ENGINE_DIRECT, 0.0, 0.0, std::vector<Compl<double> >()};
+
+/* iteration cache, enabled by --cache-size or --cache-dir */
+int cache_size_mb = 0;
+std::string cache_dir;
+
+/* adaptive anti-aliasing, enabled by --aa */
+int aa_samples = 1;   // sub-pixel samples per axis on edge pixels, 1 is off
+int aa_threshold = 1; // iteration difference to a neighbour that makes an edge
+
+/* band streaming, enabled by --stream */
+std::string stream_path;
+
+/* server mode, enabled by --serve */
+std::string serve_path; // "-" for stdin / stdout, otherwise a Unix domain socket
+
+/* animation mode, enabled by --keyframes */
+std::string keyframe_path;
+int n_frames = 100;
+std::string output_prefix = "frame";
+
+/* per-worker time and iterations after the summary, enabled by --stats */
+bool print_stats = false;
+
+/*
+how many ulps of headroom a precision must have over the pixel spacing; the
+iteration amplifies rounding errors, so resolving the spacing exactly is not
+enough
+*/
+const double PRECISION_MARGIN = 256.0;
+
+/* reference candidates per axis tried when the center of the view escapes */
+const int REFERENCE_CANDIDATES = 5;
+
 /* to keep track of time */
 std::chrono::high_resolution_clock::time_point t1;
 std::chrono::high_resolution_clock::time_point t2;
 std::chrono::duration<double> time_span;
 
 
+void init_points(Point* p, int begin, int count) {
+    /*
+    Set the coordinates of count points starting at index begin of the
+    (column major) data array, so that any slice can be set up on its own.
+    */
+    int x = begin / Y_RESN, y = begin % Y_RESN;
+    for (int i = 0; i < count; i++, p++) {
+        p->x = x;
+        p->y = y;
+        if (++y == Y_RESN) {
+            y = 0;
+            x++;
+        }
+    }
+}
+
+void alloc_data() {
+    /*
+    Allocate data without writing it. Point has no constructor, so the pages
+    are only placed (on the NUMA node of the first thread that writes them)
+    when init_points() touches them.
+    */
+    total_size = X_RESN * Y_RESN;
+    data = new Point[total_size];
+}
+
 void init_data() {
     /*
     Initialize data storage.
@@ -56,54 +181,646 @@ void init_data() {
     color_i is in {0, 1}
     */
 
-    total_size = X_RESN * Y_RESN;
-    data = new Point[total_size];
-    int i, j;
-    Point* p = data;
-    for (i = 0; i < X_RESN; i++) {
-        for (j = 0; j < Y_RESN; j++) {
-            p->x = i;
-            p->y = j;
-            p++;
+    alloc_data();
+    init_points(data, 0, total_size);
+}
+
+const char* precision_name(Precision precision) {
+    switch (precision) {
+        case PRECISION_FLOAT: return "float";
+        case PRECISION_DOUBLE: return "double";
+        case PRECISION_DOUBLE_DOUBLE: return "double-double";
+        default: return "auto";
+    }
+}
+
+const char* engine_name(Engine engine) {
+    switch (engine) {
+        case ENGINE_DIRECT: return "direct";
+        case ENGINE_PERTURBATION: return "perturbation";
+        default: return "auto";
+    }
+}
+
+const char* formula_name(Formula formula) {
+    switch (formula) {
+        case FORMULA_JULIA: return "julia";
+        case FORMULA_BURNING_SHIP: return "burning-ship";
+        case FORMULA_MULTIBROT3: return "multibrot3";
+        case FORMULA_MULTIBROT4: return "multibrot4";
+        case FORMULA_MULTIBROT5: return "multibrot5";
+        default: return "mandelbrot";
+    }
+}
+
+Formula parse_formula(const char* name) {
+    if (strcmp(name, "julia") == 0) return FORMULA_JULIA;
+    if (strcmp(name, "burning-ship") == 0) return FORMULA_BURNING_SHIP;
+    if (strcmp(name, "multibrot3") == 0) return FORMULA_MULTIBROT3;
+    if (strcmp(name, "multibrot4") == 0) return FORMULA_MULTIBROT4;
+    if (strcmp(name, "multibrot5") == 0) return FORMULA_MULTIBROT5;
+    return FORMULA_MANDELBROT;
+}
+
+Engine parse_engine(const char* name) {
+    if (strcmp(name, "direct") == 0) return ENGINE_DIRECT;
+    if (strcmp(name, "perturbation") == 0) return ENGINE_PERTURBATION;
+    return ENGINE_AUTO;
+}
+
+Precision parse_precision(const char* name) {
+    if (strcmp(name, "float") == 0) return PRECISION_FLOAT;
+    if (strcmp(name, "double") == 0) return PRECISION_DOUBLE;
+    if (strcmp(name, "dd") == 0 || strcmp(name, "double-double") == 0)
+        return PRECISION_DOUBLE_DOUBLE;
+    return PRECISION_AUTO;
+}
+
+Precision select_precision(const Viewport& vp) {
+    /*
+    Pick the precision for one frame.
+    A scalar type is good enough if the distance between two neighbouring
+    pixels is well above its rounding error at the largest coordinate in view.
+    */
+    if (vp.precision != PRECISION_AUTO) return vp.precision;
+
+    const double pixel =
+        std::min(vp.scale / (X_RESN / 2), vp.scale * vp.aspect / (Y_RESN / 2));
+    const double magnitude =
+        std::max(std::fabs(vp.center_real.hi), std::fabs(vp.center_imag.hi)) +
+        vp.scale * std::max(1.0, vp.aspect);
+
+    if (pixel > magnitude * FLT_EPSILON * PRECISION_MARGIN) return PRECISION_FLOAT;
+    if (pixel > magnitude * DBL_EPSILON * PRECISION_MARGIN) return PRECISION_DOUBLE;
+    return PRECISION_DOUBLE_DOUBLE;
+}
+
+std::vector<char*> parse_args(int argc, char* argv[]) {
+    /*
+    Split the command line into positional arguments, which are returned, and
+    "--key=value" options, which configure the global viewport:
+
+    --center-re=<real>  --center-im=<imag>  center of the view
+    --scale=<s>         half width of the view along the real axis
+    --aspect=<a>        height / width of the view
+    --precision=<auto|float|double|dd>
+    --engine=<auto|direct|perturbation>
+    --formula=<mandelbrot|julia|burning-ship|multibrot3|multibrot4|multibrot5>
+    --julia-re=<real>   --julia-im=<imag>   the constant c of the Julia set
+
+    adaptive anti-aliasing:
+
+    --aa=<n>            supersample edge pixels with n x n samples
+    --aa-threshold=<k>  iteration difference that makes a pixel an edge
+
+    and the animation mode:
+
+    --keyframes=<file>  render a zoom along the keyframes in file
+    --frames=<n>        number of frames of the animation
+    --output=<prefix>   frames are written to <prefix>_<index>.pgm
+
+    and the server and streaming modes (pthread):
+
+    --serve=<-|socket>  render jobs read from stdin or a Unix domain socket
+    --stream=<file>     render in bands straight into a PGM file
+    --affinity=<none|compact|scatter>  pin threads to CPUs
+    --stats             report the time and iterations of every worker
+
+    and the iteration cache:
+
+    --cache-size=<MB>   memory for cached tiles, least recently used are evicted
+    --cache-dir=<dir>   evicted tiles are spilled to dir and found there later
+    */
+    std::vector<char*> positional;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            positional.push_back(argv[i]);
+            continue;
         }
+
+        const char* eq = strchr(argv[i], '=');
+        const std::string key = eq ? std::string(argv[i] + 2, eq - argv[i] - 2)
+                                 : std::string(argv[i] + 2);
+        const char* value = eq ? eq + 1 : "";
+
+        if (key == "center-re") view.center_real = dd_from_string(value);
+        else if (key == "center-im") view.center_imag = dd_from_string(value);
+        else if (key == "scale") view.scale = atof(value);
+        else if (key == "aspect") view.aspect = atof(value);
+        else if (key == "precision") view.precision = parse_precision(value);
+        else if (key == "engine") view.engine = parse_engine(value);
+        else if (key == "formula") view.formula = parse_formula(value);
+        else if (key == "julia-re") view.julia.real = atof(value);
+        else if (key == "julia-im") view.julia.imag = atof(value);
+        else if (key == "aa") aa_samples = std::max(atoi(value), 1);
+        else if (key == "aa-threshold") aa_threshold = atoi(value);
+        else if (key == "keyframes") keyframe_path = value;
+        else if (key == "frames") n_frames = atoi(value);
+        else if (key == "output") output_prefix = value;
+        else if (key == "serve") serve_path = value;
+        else if (key == "stream") stream_path = value;
+        else if (key == "affinity") affinity = parse_affinity(value);
+        else if (key == "stats") print_stats = true;
+        else if (key == "cache-size") cache_size_mb = atoi(value);
+        else if (key == "cache-dir") cache_dir = value;
+        else fprintf(stderr, "Unknown option: %s\n", argv[i]);
     }
+    return positional;
 }
 
-void compute(Point* p) {
+/* narrow a double-double coordinate to the scalar type used by the kernel */
+template <typename T>
+inline T scalar_cast(const DoubleDouble& x) {
+    return (T) x.hi;
+}
+
+template <>
+inline DoubleDouble scalar_cast<DoubleDouble>(const DoubleDouble& x) {
+    return x;
+}
+
+template <typename T>
+inline Compl<T> pixel_to_c(const Viewport& vp, int x, int y) {
+    /* scale [0, X_RESN] x [0, Y_RESN] to the viewport, [-1, 1] x [-1, 1] by default */
+    Compl<T> c;
+    c.real = ((T) x - X_RESN / 2) / (X_RESN / 2) * (T) vp.scale +
+             scalar_cast<T>(vp.center_real);
+    c.imag = ((T) y - Y_RESN / 2) / (Y_RESN / 2) * (T) (vp.scale * vp.aspect) +
+             scalar_cast<T>(vp.center_imag);
+    return c;
+}
+
+/*
+Formula policies.
+An escape-time fractal is a struct with two inlined functions: start() sets
+z_0 and the constant c of a pixel, step() does one iteration z -> f(z, c).
+The kernels are templates on the policy, so every formula gets its own loop
+without any dispatch per iteration.
+*/
+
+template <typename T>
+inline T abs_value(const T& x) {
+    return x < T(0.0) ? -x : x;
+}
+
+struct Mandelbrot {
+    /* z = z^2 + c from z = 0, c is the pixel */
+    template <typename T>
+    static inline void start(const Compl<T>& pixel, const Viewport&, Compl<T>& z,
+                             Compl<T>& c) {
+        z.real = z.imag = T(0.0);
+        c = pixel;
+    }
+
+    template <typename T>
+    static inline void step(T& real, T& imag, const T& c_real, const T& c_imag) {
+        const T temp = real * real - imag * imag + c_real;
+        imag = T(2.0) * real * imag + c_imag;
+        real = temp;
+    }
+};
+
+struct Julia : Mandelbrot {
+    /* z = z^2 + c from z = the pixel, c is fixed */
+    template <typename T>
+    static inline void start(const Compl<T>& pixel, const Viewport& vp, Compl<T>& z,
+                             Compl<T>& c) {
+        z = pixel;
+        c.real = (T) vp.julia.real;
+        c.imag = (T) vp.julia.imag;
+    }
+};
+
+struct BurningShip : Mandelbrot {
+    /* z = (|Re z| + i |Im z|)^2 + c */
+    template <typename T>
+    static inline void step(T& real, T& imag, const T& c_real, const T& c_imag) {
+        const T temp = real * real - imag * imag + c_real;
+        imag = T(2.0) * abs_value(real * imag) + c_imag;
+        real = temp;
+    }
+};
+
+template <int N>
+struct Multibrot : Mandelbrot {
+    /* z = z^N + c, the power is unrolled at compile time */
+    template <typename T>
+    static inline void step(T& real, T& imag, const T& c_real, const T& c_imag) {
+        T r = real, i = imag;
+        for (int n = 1; n < N; n++) {
+            const T temp = r * real - i * imag;
+            i = r * imag + i * real;
+            r = temp;
+        }
+        real = r + c_real;
+        imag = i + c_imag;
+    }
+};
+
+template <typename Func>
+void with_formula(const Viewport& vp, Func func) {
+    /* call func with the policy of the viewport's formula */
+    switch (vp.formula) {
+        case FORMULA_JULIA: func(Julia()); break;
+        case FORMULA_BURNING_SHIP: func(BurningShip()); break;
+        case FORMULA_MULTIBROT3: func(Multibrot<3>()); break;
+        case FORMULA_MULTIBROT4: func(Multibrot<4>()); break;
+        case FORMULA_MULTIBROT5: func(Multibrot<5>()); break;
+        default: func(Mandelbrot()); break;
+    }
+}
+
+template <typename F, typename T>
+inline int iterate(const Compl<T>& c, Compl<T>& z, int k) {
+    /*
+    Continue iterating z from iteration k until it escapes or max_iteration is
+    reached. Return the number of iterations done, z is left at its last value.
+    */
+    T real = z.real, imag = z.imag; // keep z in registers
+    T lengthsq;
+
+    while (k < max_iteration) {
+        F::step(real, imag, c.real, c.imag);
+        lengthsq = real * real + imag * imag;
+        k++;
+        if (!(lengthsq < T(4.0))) break;
+    }
+
+    z.real = real;
+    z.imag = imag;
+    return k;
+}
+
+template <typename F, typename T>
+inline int escape_time(const Compl<T>& pixel, const Viewport& vp) {
+    /* Iterate a pixel from its start, return the number of iterations done. */
+    Compl<T> z, c;
+    F::start(pixel, vp, z, c);
+    return iterate<F>(c, z, 0);
+}
+
+template <typename F, typename T>
+int compute(Point* p, const Viewport& vp) {
     /*
     Give a Point p, compute its color.
-    Mandelbrot Set Computation.
-    It is not necessary to modify this function, because it is a completed one.
-    *** However, to further improve the performance, you may change this function to do batch computation.
+    Escape-time computation of formula F with scalar type T.
+    Return the number of iterations.
     */
+    const int k = escape_time<F>(pixel_to_c<T>(vp, p->x, p->y), vp);
+    p->color = (float) k / max_iteration;
+    return k;
+}
 
-    Compl z, c;
-    float lengthsq, temp;
+/* pixels iterated side by side by compute_lanes(), a few vector registers wide */
+const int LANES = 8;
 
-    /* scale [0, X_RESN] x [0, Y_RESN] to [-1, 1] x [-1, 1] */
-    c.real = ((float) p->x - X_RESN / 2) / (X_RESN / 2);
-    c.imag = ((float) p->y - Y_RESN / 2) / (Y_RESN / 2);
+/* double-double is far too wide for lanes and is iterated pixel by pixel */
+template <typename T>
+struct lane_batched {
+    static const bool value = true;
+};
 
-    /* the following block is about math. */
-    z.real = z.imag = 0.0;
-    int k = 0;
+template <>
+struct lane_batched<DoubleDouble> {
+    static const bool value = false;
+};
+
+/* the state of LANES pixels iterated side by side */
+template <typename T>
+struct Lanes {
+    T z_real[LANES], z_imag[LANES], c_real[LANES], c_imag[LANES];
+    int k[LANES], alive[LANES];
+};
+
+template <typename F, typename T>
+inline void iterate_lanes(Lanes<T>& lanes, int start) {
+    /*
+    Step the alive lanes, all at iteration start, until they escape or
+    reach max_iteration. k and alive end as in iterate(); so does z of the
+    lanes that reached the limit, escaped lanes keep stepping and their z
+    is garbage. The lanes are copied to locals, which the compiler keeps in
+    vector registers.
+    */
+    T z_real[LANES], z_imag[LANES], c_real[LANES], c_imag[LANES];
+    int k[LANES], alive[LANES];
+    for (int l = 0; l < LANES; l++) {
+        z_real[l] = lanes.z_real[l];
+        z_imag[l] = lanes.z_imag[l];
+        c_real[l] = lanes.c_real[l];
+        c_imag[l] = lanes.c_imag[l];
+        k[l] = lanes.k[l];
+        alive[l] = lanes.alive[l];
+    }
+
+    for (int i = start; i < max_iteration; i++) {
+        int any = 0;
+        for (int l = 0; l < LANES; l++) {
+            T real = z_real[l], imag = z_imag[l];
+            F::step(real, imag, c_real[l], c_imag[l]);
+            k[l] += alive[l];
+            alive[l] &= real * real + imag * imag < T(4.0);
+            z_real[l] = real;
+            z_imag[l] = imag;
+            any |= alive[l];
+        }
+        if (!any) break;
+    }
+
+    for (int l = 0; l < LANES; l++) {
+        lanes.z_real[l] = z_real[l];
+        lanes.z_imag[l] = z_imag[l];
+        lanes.k[l] = k[l];
+        lanes.alive[l] = alive[l];
+    }
+}
+
+template <typename F, typename T>
+long compute_lanes(Point* first, Point* last, const Viewport& vp) {
+    /*
+    Iterate LANES pixels in lock step. Escaped lanes stop counting but keep
+    stepping, so the loop over lanes has no branches and is vectorized; a
+    group is done when all of its lanes are. Neighbouring pixels mostly
+    escape together, so little work is wasted. Results are identical to
+    compute(). Return the iterations of all pixels, not counting the steps
+    of escaped lanes.
+    */
+    long iterations = 0;
+    for (Point* p = first; p < last; p += LANES) {
+        const int n = (int) std::min<long>(LANES, last - p);
+        Lanes<T> lanes;
+
+        for (int l = 0; l < LANES; l++) {
+            Compl<T> z, c;
+            z.real = z.imag = c.real = c.imag = T(0.0);
+            if (l < n) F::start(pixel_to_c<T>(vp, p[l].x, p[l].y), vp, z, c);
+            lanes.z_real[l] = z.real;
+            lanes.z_imag[l] = z.imag;
+            lanes.c_real[l] = c.real;
+            lanes.c_imag[l] = c.imag;
+            lanes.k[l] = 0;
+            lanes.alive[l] = l < n;
+        }
+
+        iterate_lanes<F>(lanes, 0);
+
+        for (int l = 0; l < n; l++) {
+            p[l].color = (float) lanes.k[l] / max_iteration;
+            iterations += lanes.k[l];
+        }
+    }
+    return iterations;
+}
+
+/*
+Real-axis symmetry.
+c and conj(c) escape after the same number of iterations. When the view is
+centered on the real axis, row y and row 2 * (Y_RESN / 2) - y sample exactly
+conjugate points (the pixel coordinates are negated without rounding), so
+one of them can be copied instead of computed.
+*/
+
+bool formula_symmetric(const Viewport& vp) {
+    /* whether conj(c) escapes like c, the Burning Ship folds z and is not symmetric */
+    switch (vp.formula) {
+        case FORMULA_JULIA: return vp.julia.imag == 0.0;
+        case FORMULA_BURNING_SHIP: return false;
+        default: return true;
+    }
+}
+
+bool mirror_symmetric(const Viewport& vp) {
+    /* the perturbation reference is generally off the axis, so only direct renders */
+    return vp.selected_engine == ENGINE_DIRECT && formula_symmetric(vp) &&
+           vp.center_imag.hi == 0.0 && vp.center_imag.lo == 0.0;
+}
+
+template <typename Run, typename Copy>
+long for_each_run(Point* begin, Point* end, const Viewport& vp, Run run, Copy copy) {
+    /*
+    Split a block into runs of points to compute, run(first, last), and
+    points to copy from their mirror, copy(dst, src). Only mirrors inside the
+    block are used, so every worker only touches its own points. The block
+    must be in init_points() order, i.e. consecutive global indices. run()
+    returns the iterations it executed, the sum over all runs is returned.
+    */
+    if (!mirror_symmetric(vp))
+        return run(begin, end);
+
+    long iterations = 0;
+    const int axis = Y_RESN / 2;
+    for (Point* col = begin; col != end;) {
+        /* the part [y0, y1) of column col->x that lies in the block */
+        const int y0 = col->y;
+        const int n = (int) std::min<long>(end - col, Y_RESN - y0);
+        const int y1 = y0 + n;
+
+        /* rows below the axis whose mirror is in [y0, y1) and in the frame */
+        const int copy_begin = std::max(y0, std::max(2 * axis - y1, 2 * axis - Y_RESN) + 1);
+        const int copy_end = std::min(axis, 2 * axis - y0 + 1);
+        if (copy_begin < copy_end) {
+            iterations += run(col, col + (copy_begin - y0));
+            iterations += run(col + (copy_end - y0), col + n);
+            for (int y = copy_begin; y < copy_end; y++)
+                copy(col + (y - y0), col + (2 * axis - y - y0));
+        } else {
+            iterations += run(col, col + n);
+        }
+        col += n;
+    }
+    return iterations;
+}
+
+template <typename F, typename T>
+long compute_block(Point* begin, Point* end, const Viewport& vp) {
+    return for_each_run(begin, end, vp,
+                        [&vp](Point* first, Point* last) {
+                            if (lane_batched<T>::value)
+                                return compute_lanes<F, T>(first, last, vp);
+                            long iterations = 0;
+                            for (Point* cur = first; cur != last; cur++)
+                                iterations += compute<F, T>(cur, vp);
+                            return iterations;
+                        },
+                        [](Point* dst, const Point* src) { dst->color = src->color; });
+}
+
+/*
+Perturbation engine.
+Only the reference orbit Z_n is iterated in high precision, every pixel
+c = C + dc follows it as a delta z_n = Z_n + dz_n with
+    dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc
+which only needs the precision of the (tiny) deltas, not of the coordinates.
+*/
+
+int reference_orbit(const DoubleDouble& c_real, const DoubleDouble& c_imag,
+                    std::vector<Compl<double> >& orbit) {
+    /*
+    Iterate the reference point in double-double and store Z_0 = 0, Z_1, ...
+    rounded to double, until it escapes or max_iteration is reached.
+    Return the number of iterations done.
+    */
+    Compl<DoubleDouble> z;
+    DoubleDouble temp;
+    Compl<double> zd = {0.0, 0.0};
+
+    z.real = z.imag = DoubleDouble(0.0);
+    orbit.clear();
+    orbit.push_back(zd);
 
+    int k = 0;
+    double lengthsq;
     do {
-        temp = z.real * z.real - z.imag * z.imag + c.real;
-        z.imag = 2.0f * z.real * z.imag + c.imag;
+        temp = z.real * z.real - z.imag * z.imag + c_real;
+        z.imag = DoubleDouble(2.0) * z.real * z.imag + c_imag;
         z.real = temp;
-        lengthsq = z.real * z.real + z.imag * z.imag;
+        zd.real = z.real.hi;
+        zd.imag = z.imag.hi;
+        orbit.push_back(zd);
+        lengthsq = zd.real * zd.real + zd.imag * zd.imag;
         k++;
     } while (lengthsq < 4.0 && k < max_iteration);
-    /* math block end */
 
-    p->color = (float) k / max_iteration;
+    return k;
+}
+
+void setup_reference(Viewport& vp) {
+    /*
+    Compute the reference orbit at the center of the view. If the center
+    escapes early, the pixels would have to rebase onto a short orbit all the
+    time, so try a grid of candidates and keep the one that survives longest.
+    */
+    std::vector<Compl<double> > orbit;
+    vp.reference_real = vp.reference_imag = 0.0;
+    int best = reference_orbit(vp.center_real, vp.center_imag, vp.reference);
+
+    for (int i = 0; i < REFERENCE_CANDIDATES && best < max_iteration; i++) {
+        for (int j = 0; j < REFERENCE_CANDIDATES && best < max_iteration; j++) {
+            const double dr = vp.scale * (2.0 * (i + 0.5) / REFERENCE_CANDIDATES - 1.0);
+            const double di =
+                vp.scale * vp.aspect * (2.0 * (j + 0.5) / REFERENCE_CANDIDATES - 1.0);
+            const int k = reference_orbit(vp.center_real + DoubleDouble(dr),
+                                          vp.center_imag + DoubleDouble(di), orbit);
+            if (k > best) {
+                best = k;
+                vp.reference.swap(orbit);
+                vp.reference_real = dr;
+                vp.reference_imag = di;
+            }
+        }
+    }
+}
+
+template <typename T>
+inline int perturbed_escape_time(const std::vector<Compl<double> >& ref,
+                                 const Compl<T>& dc) {
+    /*
+    Iterate dz from dz_0 = 0 along the reference orbit, return the number of
+    iterations done.
 
+    Glitch detection and rebasing: once |Z_n + dz_n| < |dz_n| the delta is no
+    longer small compared to the value it represents, and when the reference
+    itself escapes there is no Z_{n+1} to follow. In both cases the full value
+    z = Z_n + dz_n becomes the new delta against Z_0 = 0, and the pixel keeps
+    following the reference orbit from its start.
+    */
+    Compl<T> dz;
+    T lengthsq, temp;
+
+    dz.real = dz.imag = T(0.0);
+    const int last = (int) ref.size() - 1;
+    int n = 0, k = 0;
+
+    do {
+        const T zr = (T) ref[n].real, zi = (T) ref[n].imag;
+        temp = T(2.0) * (zr * dz.real - zi * dz.imag) + dz.real * dz.real -
+               dz.imag * dz.imag + dc.real;
+        dz.imag = T(2.0) * (zr * dz.imag + zi * dz.real + dz.real * dz.imag) + dc.imag;
+        dz.real = temp;
+        n++;
+        k++;
+
+        const T real = (T) ref[n].real + dz.real, imag = (T) ref[n].imag + dz.imag;
+        lengthsq = real * real + imag * imag;
+        if (lengthsq < dz.real * dz.real + dz.imag * dz.imag || n == last) {
+            dz.real = real;
+            dz.imag = imag;
+            n = 0;
+        }
+    } while (lengthsq < T(4.0) && k < max_iteration);
+
+    return k;
+}
+
+template <typename T>
+int compute_perturbed(Point* p, const Viewport& vp) {
+    /* same as compute(), the pixel is expressed as an offset from the reference */
+    Compl<T> dc;
+    dc.real = (T) (((double) p->x - X_RESN / 2) / (X_RESN / 2) * vp.scale -
+                   vp.reference_real);
+    dc.imag = (T) (((double) p->y - Y_RESN / 2) / (Y_RESN / 2) * vp.scale * vp.aspect -
+                   vp.reference_imag);
+    const int k = perturbed_escape_time(vp.reference, dc);
+    p->color = (float) k / max_iteration;
+    return k;
 }
 
-void compute_block(Point* begin, Point* end) {
+template <typename T>
+long compute_block_perturbed(Point* begin, Point* end, const Viewport& vp) {
+    long iterations = 0;
     for (Point* cur = begin; cur != end; cur++)
-        compute(cur);
+        iterations += compute_perturbed<T>(cur, vp);
+    return iterations;
+}
+
+void setup_viewport(Viewport& vp) {
+    /*
+    Prepare a viewport for rendering, must be called once per frame.
+    Deep zooms that would need double-double go to the perturbation engine,
+    whose deltas are iterated in double (or float if requested explicitly).
+    */
+    vp.selected_precision = select_precision(vp);
+    vp.selected_engine = vp.engine;
+    if (vp.formula != FORMULA_MANDELBROT)
+        /* the perturbation formula is specific to z^2 + c */
+        vp.selected_engine = ENGINE_DIRECT;
+    else if (vp.engine == ENGINE_AUTO)
+        vp.selected_engine = vp.selected_precision == PRECISION_DOUBLE_DOUBLE
+                                 ? ENGINE_PERTURBATION
+                                 : ENGINE_DIRECT;
+
+    if (vp.selected_engine == ENGINE_PERTURBATION) {
+        setup_reference(vp);
+        /* float deltas underflow long before double ones do */
+        const bool float_deltas = vp.precision == PRECISION_FLOAT && vp.scale > 1e-30;
+        vp.selected_precision = float_deltas ? PRECISION_FLOAT : PRECISION_DOUBLE;
+    } else {
+        vp.reference.clear();
+    }
+}
+
+long compute_block(Point* begin, Point* end, const Viewport& vp = view) {
+    /*
+    Compute a block of points, return the iterations executed.
+    Engine, formula and precision are fixed for a frame, so dispatch once per block.
+    */
+    if (vp.selected_engine == ENGINE_PERTURBATION) {
+        if (vp.selected_precision == PRECISION_FLOAT)
+            return compute_block_perturbed<float>(begin, end, vp);
+        return compute_block_perturbed<double>(begin, end, vp);
+    }
+
+    long iterations = 0;
+    with_formula(vp, [&](auto formula) {
+        typedef decltype(formula) F;
+        switch (vp.selected_precision) {
+            case PRECISION_DOUBLE: iterations = compute_block<F, double>(begin, end, vp); break;
+            case PRECISION_DOUBLE_DOUBLE:
+                iterations = compute_block<F, DoubleDouble>(begin, end, vp);
+                break;
+            default: iterations = compute_block<F, float>(begin, end, vp); break;
+        }
+    });
+    return iterations;
 }
 
 #ifdef GUI
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+
+/*
+A double-double number stores a value as the unevaluated sum hi + lo of two
+doubles, which gives about 32 significant decimal digits. It is used by the
+Mandelbrot kernel when the viewport is zoomed in beyond what double can
+resolve. Algorithms follow Dekker / Knuth error-free transformations.
+*/
+struct DoubleDouble {
+    double hi, lo;
+
+    DoubleDouble() : hi(0.0), lo(0.0) {}
+    DoubleDouble(double h) : hi(h), lo(0.0) {}
+    DoubleDouble(double h, double l) : hi(h), lo(l) {}
+};
+
+/* s + e = a + b exactly, assuming |a| >= |b| */
+inline DoubleDouble quick_two_sum(double a, double b) {
+    double s = a + b;
+    double e = b - (s - a);
+    return DoubleDouble(s, e);
+}
+
+/* s + e = a + b exactly */
+inline DoubleDouble two_sum(double a, double b) {
+    double s = a + b;
+    double bb = s - a;
+    double e = (a - (s - bb)) + (b - bb);
+    return DoubleDouble(s, e);
+}
+
+/* p + e = a * b exactly */
+inline DoubleDouble two_prod(double a, double b) {
+    double p = a * b;
+#ifdef __FMA__
+    double e = std::fma(a, b, -p);
+#else
+    /* Dekker's split when no hardware fma is available */
+    const double split = 134217729.0; // 2^27 + 1
+    double t = split * a;
+    double a_hi = t - (t - a), a_lo = a - a_hi;
+    t = split * b;
+    double b_hi = t - (t - b), b_lo = b - b_hi;
+    double e = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+#endif
+    return DoubleDouble(p, e);
+}
+
+inline DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b) {
+    DoubleDouble s = two_sum(a.hi, b.hi);
+    DoubleDouble t = two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return quick_two_sum(s.hi, s.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a) {
+    return DoubleDouble(-a.hi, -a.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b) {
+    return a + (-b);
+}
+
+inline DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b) {
+    DoubleDouble p = two_prod(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return quick_two_sum(p.hi, p.lo);
+}
+
+inline DoubleDouble operator/(const DoubleDouble& a, const DoubleDouble& b) {
+    /* long division: one correction step on top of the double quotient */
+    double q1 = a.hi / b.hi;
+    DoubleDouble r = a - b * DoubleDouble(q1);
+    double q2 = r.hi / b.hi;
+    return quick_two_sum(q1, q2);
+}
+
+inline bool operator<(const DoubleDouble& a, const DoubleDouble& b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+/*
+Parse a decimal string such as "-0.743643887037158704752191506114774" into a
+double-double without going through a (lossy) double first.
+*/
+inline DoubleDouble dd_from_string(const char* s) {
+    bool negative = false;
+    if (*s == '+' || *s == '-') negative = *s++ == '-';
+
+    DoubleDouble value;
+    int exponent = 0;
+    bool fraction = false;
+    for (; *s; s++) {
+        if (*s == '.') {
+            fraction = true;
+        } else if (*s >= '0' && *s <= '9') {
+            value = value * DoubleDouble(10.0) + DoubleDouble(*s - '0');
+            if (fraction) exponent--;
+        } else if (*s == 'e' || *s == 'E') {
+            exponent += atoi(s + 1);
+            break;
+        } else {
+            break;
+        }
+    }
+
+    for (; exponent > 0; exponent--) value = value * DoubleDouble(10.0);
+    for (; exponent < 0; exponent++) value = value / DoubleDouble(10.0);
+    return negative ? -value : value;
+}
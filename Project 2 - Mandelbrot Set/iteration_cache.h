@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstdio>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+
+#include "asg2.h"
+
+/*
+Incremental iteration cache.
+
+A tile is a range of pixels rendered with one viewport and resolution. For
+every pixel it remembers the iteration count, and for pixels that hit the
+limit also their current z. Rendering the same tile again with a higher
+max_iteration then only continues the unresolved pixels instead of starting
+over from z = 0.
+
+Tiles live in memory in least recently used order and are spilled to a
+directory, if one is given, when they are evicted or when the cache is
+flushed at exit.
+*/
+
+struct TileState {
+    std::string key;
+    int begin, count;       // global index range of the pixels
+    int max_iteration;      // limit the tile was rendered with, 0 if never
+    std::vector<int> iterations;
+    std::vector<Compl<double> > z;
+    int pins;               // tiles in use are never evicted
+
+    size_t bytes() const {
+        return iterations.size() * sizeof(int) + z.size() * sizeof(Compl<double>);
+    }
+};
+
+class IterationCache {
+public:
+    IterationCache(size_t capacity_bytes, const std::string& spill_dir) :
+        capacity(capacity_bytes), used(0), dir(spill_dir) {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+
+    ~IterationCache() {
+        flush();
+        pthread_mutex_destroy(&mutex);
+    }
+
+    TileState* acquire(const std::string& key, int begin, int count) {
+        /*
+        Find a tile in memory or on disk, or create a blank one. The tile is
+        pinned until release() and becomes the most recently used.
+        */
+        pthread_mutex_lock(&mutex);
+        TileState* tile;
+        auto it = index.find(key);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            tile = &lru.front();
+        } else {
+            lru.push_front(TileState());
+            tile = &lru.front();
+            tile->key = key;
+            if (!load(*tile) || tile->begin != begin || tile->count != count) {
+                tile->begin = begin;
+                tile->count = count;
+                tile->max_iteration = 0;
+                tile->iterations.assign(count, 0);
+                tile->z.assign(count, Compl<double>{0.0, 0.0});
+            }
+            tile->pins = 0;
+            index[key] = lru.begin();
+            used += tile->bytes();
+        }
+        tile->pins++;
+        pthread_mutex_unlock(&mutex);
+        return tile;
+    }
+
+    void release(TileState* tile) {
+        /* the tile is now valid up to max_iteration */
+        pthread_mutex_lock(&mutex);
+        tile->max_iteration = std::max(tile->max_iteration, max_iteration);
+        tile->pins--;
+        evict();
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void flush() {
+        /* write all tiles to the spill directory */
+        pthread_mutex_lock(&mutex);
+        for (auto it = lru.begin(); it != lru.end(); ++it)
+            spill(*it);
+        pthread_mutex_unlock(&mutex);
+    }
+
+private:
+    void evict() {
+        /* drop least recently used tiles until the cache fits its capacity */
+        auto it = lru.end();
+        while (used > capacity && it != lru.begin()) {
+            --it;
+            if (it->pins > 0) continue;
+            spill(*it);
+            used -= it->bytes();
+            index.erase(it->key);
+            it = lru.erase(it);
+        }
+    }
+
+    std::string path(const std::string& key) const {
+        /* FNV-1a hash of the key; the key is stored in the file to catch collisions */
+        unsigned long long h = 1469598103934665603ULL;
+        for (size_t i = 0; i < key.size(); i++) {
+            h ^= (unsigned char) key[i];
+            h *= 1099511628211ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.tile", h);
+        return dir + "/" + name;
+    }
+
+    void spill(const TileState& tile) const {
+        /* only the z of unresolved pixels is stored, the others are final */
+        if (dir.empty() || tile.max_iteration == 0) return;
+        FILE* f = fopen(path(tile.key).c_str(), "wb");
+        if (f == nullptr) return;
+
+        const int key_size = (int) tile.key.size();
+        fwrite(&key_size, sizeof(int), 1, f);
+        fwrite(tile.key.data(), 1, key_size, f);
+        fwrite(&tile.begin, sizeof(int), 1, f);
+        fwrite(&tile.count, sizeof(int), 1, f);
+        fwrite(&tile.max_iteration, sizeof(int), 1, f);
+        fwrite(tile.iterations.data(), sizeof(int), tile.count, f);
+        for (int i = 0; i < tile.count; i++) {
+            if (tile.iterations[i] < tile.max_iteration) continue;
+            fwrite(&tile.z[i], sizeof(Compl<double>), 1, f);
+        }
+        fclose(f);
+    }
+
+    bool load(TileState& tile) const {
+        if (dir.empty()) return false;
+        FILE* f = fopen(path(tile.key).c_str(), "rb");
+        if (f == nullptr) return false;
+
+        bool ok = false;
+        int key_size;
+        if (fread(&key_size, sizeof(int), 1, f) == 1 && key_size == (int) tile.key.size()) {
+            std::string key(key_size, '\0');
+            ok = fread(&key[0], 1, key_size, f) == (size_t) key_size && key == tile.key &&
+                 fread(&tile.begin, sizeof(int), 1, f) == 1 &&
+                 fread(&tile.count, sizeof(int), 1, f) == 1 &&
+                 fread(&tile.max_iteration, sizeof(int), 1, f) == 1 && tile.count >= 0;
+        }
+        if (ok) {
+            tile.iterations.resize(tile.count);
+            tile.z.assign(tile.count, Compl<double>{0.0, 0.0});
+            ok = fread(tile.iterations.data(), sizeof(int), tile.count, f) ==
+                 (size_t) tile.count;
+            for (int i = 0; ok && i < tile.count; i++) {
+                if (tile.iterations[i] < tile.max_iteration) continue;
+                ok = fread(&tile.z[i], sizeof(Compl<double>), 1, f) == 1;
+            }
+        }
+        fclose(f);
+        return ok;
+    }
+
+    size_t capacity, used;
+    std::string dir;
+    std::list<TileState> lru; // most recently used first
+    std::unordered_map<std::string, std::list<TileState>::iterator> index;
+    pthread_mutex_t mutex;
+};
+
+/* the cache of this process, null when caching is disabled */
+IterationCache* iteration_cache = nullptr;
+
+void init_cache() {
+    if (cache_size_mb <= 0 && cache_dir.empty()) return;
+    const size_t mb = cache_size_mb > 0 ? cache_size_mb : 256;
+    iteration_cache = new IterationCache(mb << 20, cache_dir);
+}
+
+void free_cache() {
+    delete iteration_cache;
+    iteration_cache = nullptr;
+}
+
+TileState* acquire_tile(const Viewport& vp, int begin, int count) {
+    /*
+    Tile of pixels [begin, begin + count) for a viewport, or null when the
+    cache is off. Only the direct float / double kernels can be resumed: the
+    perturbation engine's state depends on the reference orbit, which changes
+    with max_iteration.
+    */
+    if (iteration_cache == nullptr || vp.selected_engine != ENGINE_DIRECT ||
+        vp.selected_precision == PRECISION_DOUBLE_DOUBLE)
+        return nullptr;
+
+    char key[512];
+    snprintf(key, sizeof(key), "%a,%a,%a,%a,%a,%a,%dx%d,%d+%d,%s,%s,%a,%a", vp.center_real.hi,
+             vp.center_real.lo, vp.center_imag.hi, vp.center_imag.lo, vp.scale, vp.aspect,
+             X_RESN, Y_RESN, begin, count, precision_name(vp.selected_precision),
+             formula_name(vp.formula), vp.julia.real, vp.julia.imag);
+    return iteration_cache->acquire(key, begin, count);
+}
+
+void release_tile(TileState* tile) {
+    if (tile != nullptr) iteration_cache->release(tile);
+}
+
+template <typename F, typename T>
+long compute_block_resumed(Point* begin, Point* end, const Viewport& vp, TileState& tile) {
+    /*
+    Same as compute_block(), but pixels resolved by an earlier render are
+    taken from the tile and unresolved ones continue from their stored z.
+    Different threads may work on disjoint parts of the same tile. Only the
+    iterations beyond the stored ones are counted.
+    */
+    const bool extend = max_iteration > tile.max_iteration;
+    auto run = [&](Point* first, Point* last) {
+        /*
+        Pixels to continue are gathered into lanes, see iterate_lanes(). They
+        all stopped at the old limit, or start from 0 in a new tile, so the
+        lanes are at the same iteration.
+        */
+        long iterations = 0;
+        Point* points[LANES];
+        int index[LANES];
+        Lanes<T> lanes;
+        int n = 0;
+
+        auto flush = [&]() {
+            for (int l = 0; l < LANES; l++) {
+                if (l >= n) {
+                    lanes.z_real[l] = lanes.z_imag[l] = T(0.0);
+                    lanes.c_real[l] = lanes.c_imag[l] = T(0.0);
+                }
+                lanes.k[l] = tile.max_iteration;
+                lanes.alive[l] = l < n;
+            }
+            iterate_lanes<F>(lanes, tile.max_iteration);
+            for (int l = 0; l < n; l++) {
+                const int i = index[l];
+                const int k = lanes.k[l];
+                iterations += k - tile.max_iteration;
+                tile.iterations[i] = k;
+                tile.z[i].real = lanes.z_real[l];
+                tile.z[i].imag = lanes.z_imag[l];
+                points[l]->color = (float) std::min(k, max_iteration) / max_iteration;
+            }
+            n = 0;
+        };
+
+        for (Point* p = first; p != last; p++) {
+            const int i = p->x * Y_RESN + p->y - tile.begin;
+            const int stored = tile.iterations[i];
+            if (stored >= tile.max_iteration && extend) {
+                Compl<T> z, c;
+                F::start(pixel_to_c<T>(vp, p->x, p->y), vp, z, c);
+                if (tile.max_iteration > 0) {
+                    z.real = (T) tile.z[i].real;
+                    z.imag = (T) tile.z[i].imag;
+                    // a pixel may have escaped exactly at the old limit
+                    if (!(z.real * z.real + z.imag * z.imag < T(4.0))) {
+                        p->color = (float) std::min(stored, max_iteration) / max_iteration;
+                        continue;
+                    }
+                }
+                points[n] = p;
+                index[n] = i;
+                lanes.z_real[n] = z.real;
+                lanes.z_imag[n] = z.imag;
+                lanes.c_real[n] = c.real;
+                lanes.c_imag[n] = c.imag;
+                if (++n == LANES) flush();
+                continue;
+            }
+            p->color = (float) std::min(stored, max_iteration) / max_iteration;
+        }
+        if (n > 0) flush();
+        return iterations;
+    };
+
+    /* a mirrored pixel's z is the conjugate of its mirror's */
+    auto copy = [&tile](Point* dst, const Point* src) {
+        const int i = dst->x * Y_RESN + dst->y - tile.begin;
+        const int j = src->x * Y_RESN + src->y - tile.begin;
+        tile.iterations[i] = tile.iterations[j];
+        tile.z[i].real = tile.z[j].real;
+        tile.z[i].imag = -tile.z[j].imag;
+        dst->color = src->color;
+    };
+
+    return for_each_run(begin, end, vp, run, copy);
+}
+
+long compute_block(Point* begin, Point* end, const Viewport& vp, TileState* tile) {
+    if (tile == nullptr) return compute_block(begin, end, vp);
+
+    long iterations = 0;
+    with_formula(vp, [&](auto formula) {
+        typedef decltype(formula) F;
+        if (vp.selected_precision == PRECISION_DOUBLE)
+            iterations = compute_block_resumed<F, double>(begin, end, vp, *tile);
+        else
+            iterations = compute_block_resumed<F, float>(begin, end, vp, *tile);
+    });
+    return iterations;
+}
@@ -1,19 +1,199 @@
 #include "asg2.h"
+#include "animation.h"
+#include "antialias.h"
+#include "iteration_cache.h"
+#include "stats.h"
 #include <cstddef>
 #include <vector>
 #include <mpi.h>
 
+int rank, world_size;
+
+MPI_Datatype MPI_POINT; // MPI data type for struct Point
+
+std::vector<WorkerStats> worker_stats; // of all ranks, gathered on rank 0
+
+
+void partition(int size, std::vector<int> &send_counts, std::vector<int> &displs) {
+    /* split size points evenly, the first ranks take the remainder */
+    const int quotient = size / world_size;
+    const int remainder = size % world_size;
+    send_counts.resize(world_size);
+    displs.resize(world_size);
+
+    for (int i = 0; i < world_size; i++) {
+        send_counts[i] = quotient;
+        if (i < remainder) send_counts[i]++;
+    }
+
+    displs[0] = 0;
+    for (int i = 1; i < world_size; i++)
+        displs[i] = displs[i - 1] + send_counts[i - 1];
+}
+
+void antialias_distributed(Point *frame, const Viewport &vp) {
+    /*
+    Supersample the edge pixels of a frame gathered on rank 0. Edges are
+    dealt round-robin, so the costly ones along the set boundary are spread
+    over all ranks instead of landing on the few that own those columns.
+    */
+    if (aa_samples <= 1) return;
+
+    int count = 0;
+    std::vector<Point> edges;
+    if (rank == 0) {
+        std::vector<Point> found = find_edges(frame);
+        count = (int) found.size();
+        edges.reserve(count);
+        for (int r = 0; r < world_size; r++)
+            for (int i = r; i < count; i += world_size)
+                edges.push_back(found[i]);
+    }
+    MPI_Bcast(&count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    // rank r got edges r, r + world_size, ..., exactly its share of partition()
+    std::vector<int> send_counts;
+    std::vector<int> displs;
+    partition(count, send_counts, displs);
+
+    std::vector<Point> sub_arr(send_counts[rank]);
+    MPI_Scatterv(
+        edges.data(), send_counts.data(), displs.data(), MPI_POINT,
+        sub_arr.data(), send_counts[rank], MPI_POINT, 0, MPI_COMM_WORLD
+    );
+    supersample_block(sub_arr.data(), sub_arr.data() + sub_arr.size(), vp);
+    MPI_Gatherv(
+        sub_arr.data(), send_counts[rank], MPI_POINT,
+        edges.data(), send_counts.data(), displs.data(), MPI_POINT, 0, MPI_COMM_WORLD
+    );
+
+    if (rank == 0) store_edges(frame, edges.data(), count);
+}
+
+void gather_stats(const WorkerStats &stats, std::vector<WorkerStats> &all) {
+    /* collect the statistics of every rank on rank 0 */
+    std::vector<double> seconds(world_size);
+    std::vector<long> iterations(world_size);
+    MPI_Gather(&stats.seconds, 1, MPI_DOUBLE, seconds.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(&stats.iterations, 1, MPI_LONG, iterations.data(), 1, MPI_LONG, 0,
+               MPI_COMM_WORLD);
+
+    all.resize(world_size);
+    for (int i = 0; i < world_size; i++) {
+        all[i].seconds = seconds[i];
+        all[i].iterations = iterations[i];
+    }
+}
+
+void render_image() {
+    if (rank == 0) init_data();
+
+    // partition the data
+    std::vector<int> send_counts;
+    std::vector<int> displs;
+    partition(total_size, send_counts, displs);
+
+    auto *sub_arr = new Point[send_counts[0]];
+
+    // distribute elements to each process
+    MPI_Scatterv(
+        data, send_counts.data(), displs.data(), MPI_POINT,
+        sub_arr, send_counts[rank], MPI_POINT, 0, MPI_COMM_WORLD
+    );
+
+    // compute a block of points, every rank caches its own slice
+    setup_viewport(view);
+    const auto start = std::chrono::high_resolution_clock::now();
+    TileState *tile = acquire_tile(view, displs[rank], send_counts[rank]);
+    WorkerStats stats;
+    stats.iterations = compute_block(sub_arr, sub_arr + send_counts[rank], view, tile);
+    release_tile(tile);
+    stats.seconds = seconds_since(start);
+    if (print_stats) gather_stats(stats, worker_stats);
+
+    // collect result from each process
+    MPI_Gatherv(
+        sub_arr, send_counts[rank], MPI_POINT,
+        data, send_counts.data(), displs.data(), MPI_POINT, 0, MPI_COMM_WORLD
+    );
+
+    // clean up
+    delete[] sub_arr;
+
+    antialias_distributed(data, view);
+}
+
+void render_animation() {
+    /*
+    Render n_frames frames along the keyframes in a single launch. Finished
+    frames go to a writer thread, so encoding and writing frame k overlaps
+    with computing the following frames.
+    */
+    std::vector<Keyframe> keyframes = load_keyframes(keyframe_path);
+    if (keyframes.empty() && rank == 0)
+        fprintf(stderr, "No keyframes in %s, using the default view\n", keyframe_path.c_str());
+
+    if (total_size < FRAME_TILE_THRESHOLD && n_frames >= world_size) {
+        /* small frames: deal whole frames round-robin, every rank writes its own */
+        FrameWriter writer(2, total_size, write_frame_pgm);
+        for (int f = rank; f < n_frames; f += world_size) {
+            Frame *frame = writer.acquire();
+            Viewport vp = animation_viewport(keyframes, f);
+            setup_viewport(vp);
+            compute_block(frame->points.data(), frame->points.data() + total_size, vp);
+            antialias(frame->points.data(), vp);
+            frame->index = f;
+            writer.submit(frame);
+        }
+        writer.finish();
+
+        // the sequence is done when the slowest rank is done
+        MPI_Barrier(MPI_COMM_WORLD);
+        return;
+    }
+
+    /* large frames: every rank computes its slice of each frame, rank 0 writes */
+    std::vector<int> send_counts;
+    std::vector<int> displs;
+    partition(total_size, send_counts, displs);
+
+    // slices never move, so their coordinates are set up once
+    std::vector<Point> sub_arr(send_counts[rank]);
+    init_points(sub_arr.data(), displs[rank], send_counts[rank]);
+
+    FrameWriter *writer = rank == 0 ? new FrameWriter(2, total_size, write_frame_pgm) : nullptr;
+    for (int f = 0; f < n_frames; f++) {
+        Viewport vp = animation_viewport(keyframes, f);
+        setup_viewport(vp);
+        compute_block(sub_arr.data(), sub_arr.data() + sub_arr.size(), vp);
+
+        Frame *frame = rank == 0 ? writer->acquire() : nullptr;
+        MPI_Gatherv(
+            sub_arr.data(), send_counts[rank], MPI_POINT,
+            frame ? frame->points.data() : nullptr, send_counts.data(), displs.data(),
+            MPI_POINT, 0, MPI_COMM_WORLD
+        );
+        antialias_distributed(frame ? frame->points.data() : nullptr, vp);
+        if (rank == 0) {
+            frame->index = f;
+            writer->submit(frame);
+        }
+    }
+    delete writer;
+}
 
 int main(int argc, char *argv[]) {
-    MPI_Init(&argc, &argv);
-    int rank, world_size;
+    // only the main thread calls MPI, the animation writer thread does file I/O
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 
-    if (argc == 4) {
-        X_RESN = atoi(argv[1]);
-        Y_RESN = atoi(argv[2]);
-        max_iteration = atoi(argv[3]);
+    std::vector<char *> params = parse_args(argc, argv);
+    if (params.size() == 3) {
+        X_RESN = atoi(params[0]);
+        Y_RESN = atoi(params[1]);
+        max_iteration = atoi(params[2]);
     } else {
         X_RESN = 800;
         Y_RESN = 800;
@@ -21,9 +201,9 @@ int main(int argc, char *argv[]) {
     }
 
     total_size = X_RESN * Y_RESN;
+    init_cache();
 
     /* create a MPI data type for struct Point */
-    MPI_Datatype MPI_POINT;
     int blocklengths[] = {1, 1, 1};
     MPI_Aint displacements[] = {offsetof(Point, x), offsetof(Point, y), offsetof(Point, color)};
     MPI_Datatype types[] = {MPI_INT, MPI_INT, MPI_FLOAT};
@@ -44,63 +224,37 @@ int main(int argc, char *argv[]) {
 #endif
 
         t1 = std::chrono::high_resolution_clock::now();
-        init_data();
-    }
-
-    // partition the data
-    const int quotient = total_size / world_size;
-    const int remainder = total_size % world_size;
-    std::vector<int> send_counts(world_size);
-    std::vector<int> displs(world_size);
-
-    for (int i = 0; i < world_size; i++) {
-        send_counts[i] = quotient;
-        if (i < remainder) send_counts[i]++;
     }
 
-    displs[0] = 0;
-    for (int i = 1; i < world_size; i++)
-        displs[i] = displs[i - 1] + send_counts[i - 1];
-
-    auto *sub_arr = new Point[quotient + 1];
-
-    // distribute elements to each process
-    MPI_Scatterv(
-        data, send_counts.data(), displs.data(), MPI_POINT,
-        sub_arr, send_counts[rank], MPI_POINT, 0, MPI_COMM_WORLD
-    );
-
-    // compute a block of points
-    compute_block(sub_arr, sub_arr + send_counts[rank]);
-
-    // collect result from each process
-    MPI_Gatherv(
-        sub_arr, send_counts[rank], MPI_POINT,
-        data, send_counts.data(), displs.data(), MPI_POINT, 0, MPI_COMM_WORLD
-    );
-
-    // clean up
-    delete[] sub_arr;
+    if (keyframe_path.empty())
+        render_image();
+    else
+        render_animation();
 
     if (rank == 0) {
         t2 = std::chrono::high_resolution_clock::now();
         time_span = t2 - t1;
 
+        const int frames = keyframe_path.empty() ? 1 : n_frames;
+
         printf("Student ID: 119020038\n");
         printf("Name: Xi Mao\n");
         printf("Assignment 2: MPI\n");
         printf("Run Time: %f seconds\n", time_span.count());
         printf("Problem Size: %d * %d, %d\n", X_RESN, Y_RESN, max_iteration);
-        printf("Processing Speed: %f pixels/s\n", total_size / time_span.count());
+        printf("Processing Speed: %f pixels/s\n", total_size / time_span.count() * frames);
         printf("Process Number: %d\n", world_size);
+        if (!keyframe_path.empty()) printf("Frame Number: %d\n", n_frames);
+        if (print_stats && !worker_stats.empty()) print_stats_report(worker_stats);
 
 #ifdef GUI
-        glutMainLoop();
+        if (keyframe_path.empty()) glutMainLoop();
 #endif
     }
 
+    free_cache();
+    MPI_Type_free(&MPI_POINT);
     MPI_Finalize();
 
     return 0;
 }
-
@@ -0,0 +1,263 @@
+#include "asg2.h"
+#include "antialias.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <cstdio>
+#include <vector>
+#include <mpi.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+Hybrid MPI + pthreads: one process per node, a thread pool in each.
+The image is cut into node level chunks of whole columns, which rank 0 hands
+out on request, so faster nodes take more chunks. Within a node the threads
+take tiles of the chunk dynamically. Rank 0 computes as well: its threads
+take chunks from the same counter while its main thread answers requests.
+*/
+
+int rank, world_size;
+int n_thd;  // threads per process
+
+/* messages of the chunk scheduler */
+const int TAG_REQUEST = 1;  // worker -> rank 0: the first request, no data
+const int TAG_RESULT = 2;   // worker -> rank 0: colors of its chunk, asks for the next one
+const int TAG_CHUNK = 3;    // rank 0 -> worker: the next chunk, -1 when there is none
+
+/* chunks per process, and tiles per thread within a chunk */
+const int CHUNKS_PER_PROCESS = 8;
+const int TILES_PER_THREAD = 4;
+
+int chunk_size, n_chunks;
+std::atomic<int> next_chunk;  // rank 0 only
+
+ThreadPool *pool;
+
+/* the chunk the local threads are working on */
+Point *chunk_points;
+int chunk_count, tile_size;
+
+/* this rank's compute time and iterations, and those of all ranks on rank 0 */
+WorkerStats rank_stats;
+std::atomic<long> rank_iterations;
+std::vector<WorkerStats> worker_stats;
+
+void chunk_range(int chunk, int &begin, int &count) {
+    begin = chunk * chunk_size;
+    count = std::min(chunk_size, total_size - begin);
+}
+
+void compute_tile(int tile, void *) {
+    const int begin = tile * tile_size;
+    const int end = std::min(begin + tile_size, chunk_count);
+    rank_iterations += compute_block(chunk_points + begin, chunk_points + end, view);
+}
+
+void compute_chunk(Point *points, int count) {
+    /* whole columns, so mirrored rows stay within a tile */
+    const auto start = std::chrono::high_resolution_clock::now();
+    chunk_points = points;
+    chunk_count = count;
+    tile_size = std::max(count / (pool->size() * TILES_PER_THREAD) / Y_RESN, 1) * Y_RESN;
+    pool->run((count + tile_size - 1) / tile_size, compute_tile, nullptr);
+    rank_stats.seconds += seconds_since(start);
+}
+
+void *local_compute(void *) {
+    /* rank 0's share: chunks straight from the counter, computed in place */
+    pin_thread(0);
+    int chunk, begin, count;
+    while ((chunk = next_chunk++) < n_chunks) {
+        chunk_range(chunk, begin, count);
+        init_points(data + begin, begin, count);
+        compute_chunk(data + begin, count);
+    }
+    return nullptr;
+}
+
+void serve_chunks() {
+    /*
+    Rank 0's main thread: answer requests until every worker was told that
+    there are no chunks left. Polling with a short sleep leaves the core to
+    the compute threads.
+    */
+    std::vector<int> assigned(world_size, -1);
+    std::vector<float> colors(chunk_size);
+    int active = world_size - 1;
+
+    while (active > 0) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+        if (!flag) {
+            usleep(50);
+            continue;
+        }
+
+        const int source = status.MPI_SOURCE;
+        if (status.MPI_TAG == TAG_RESULT) {
+            int begin, count;
+            chunk_range(assigned[source], begin, count);
+            MPI_Recv(colors.data(), count, MPI_FLOAT, source, TAG_RESULT, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+            init_points(data + begin, begin, count);
+            for (int i = 0; i < count; i++) data[begin + i].color = colors[i];
+        } else {
+            MPI_Recv(nullptr, 0, MPI_INT, source, TAG_REQUEST, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+        }
+
+        int chunk = next_chunk++;
+        if (chunk >= n_chunks) {
+            chunk = -1;
+            active--;
+        }
+        assigned[source] = chunk;
+        MPI_Send(&chunk, 1, MPI_INT, source, TAG_CHUNK, MPI_COMM_WORLD);
+    }
+}
+
+void work_chunks() {
+    /* the other ranks: request a chunk, compute it, send the colors back */
+    std::vector<Point> points(chunk_size);
+    std::vector<float> colors(chunk_size);
+    int chunk, begin, count;
+
+    MPI_Send(nullptr, 0, MPI_INT, 0, TAG_REQUEST, MPI_COMM_WORLD);
+    MPI_Recv(&chunk, 1, MPI_INT, 0, TAG_CHUNK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    while (chunk >= 0) {
+        chunk_range(chunk, begin, count);
+        init_points(points.data(), begin, count);
+        compute_chunk(points.data(), count);
+
+        // only the colors travel, the coordinates are known from the chunk
+        for (int i = 0; i < count; i++) colors[i] = points[i].color;
+        MPI_Send(colors.data(), count, MPI_FLOAT, 0, TAG_RESULT, MPI_COMM_WORLD);
+        MPI_Recv(&chunk, 1, MPI_INT, 0, TAG_CHUNK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+}
+
+void gather_stats() {
+    /* collect the statistics of every rank on rank 0 */
+    rank_stats.iterations = rank_iterations;
+    std::vector<double> seconds(world_size);
+    std::vector<long> iterations(world_size);
+    MPI_Gather(&rank_stats.seconds, 1, MPI_DOUBLE, seconds.data(), 1, MPI_DOUBLE, 0,
+               MPI_COMM_WORLD);
+    MPI_Gather(&rank_stats.iterations, 1, MPI_LONG, iterations.data(), 1, MPI_LONG, 0,
+               MPI_COMM_WORLD);
+
+    worker_stats.resize(world_size);
+    for (int i = 0; i < world_size; i++) {
+        worker_stats[i].seconds = seconds[i];
+        worker_stats[i].iterations = iterations[i];
+    }
+}
+
+/* edge pixels of the image, supersampled by rank 0's threads */
+std::vector<Point> edges;
+
+void supersample_chunk(int chunk, void *) {
+    const int begin = chunk * AA_CHUNK;
+    const int end = std::min(begin + AA_CHUNK, (int) edges.size());
+    supersample_block(edges.data() + begin, edges.data() + end, view);
+}
+
+void render_image() {
+    // node level chunks of whole columns
+    chunk_size = std::max(total_size / (world_size * CHUNKS_PER_PROCESS) / Y_RESN, 1) * Y_RESN;
+    n_chunks = (total_size + chunk_size - 1) / chunk_size;
+    next_chunk = 0;
+    rank_stats.seconds = 0;
+    rank_iterations = 0;
+
+    setup_viewport(view);
+    pool = new ThreadPool(n_thd);
+
+    if (rank == 0) {
+        // every chunk is initialized by the thread that fills it
+        alloc_data();
+        pthread_t compute_thread;
+        pthread_create(&compute_thread, nullptr, local_compute, nullptr);
+        serve_chunks();
+        pthread_join(compute_thread, nullptr);
+
+        // anti-aliasing is cheap next to the base render, rank 0 does it alone
+        if (aa_samples > 1) {
+            edges = find_edges(data);
+            pool->run(((int) edges.size() + AA_CHUNK - 1) / AA_CHUNK, supersample_chunk,
+                      nullptr);
+            store_edges(data, edges.data(), (int) edges.size());
+        }
+    } else {
+        pin_thread(0);
+        work_chunks();
+    }
+    if (print_stats) gather_stats();
+
+    delete pool;
+}
+
+int main(int argc, char *argv[]) {
+    // only the main thread calls MPI, rank 0 computes on other threads meanwhile
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    std::vector<char *> params = parse_args(argc, argv);
+    if (params.size() == 4) {
+        X_RESN = atoi(params[0]);
+        Y_RESN = atoi(params[1]);
+        max_iteration = atoi(params[2]);
+        n_thd = atoi(params[3]);
+    } else {
+        X_RESN = 800;
+        Y_RESN = 800;
+        max_iteration = 100;
+        n_thd = 4;
+    }
+
+    total_size = X_RESN * Y_RESN;
+
+    if (rank == 0) {
+#ifdef GUI
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+        glutInitWindowSize(500, 500);
+        glutInitWindowPosition(0, 0);
+        glutCreateWindow("MPI + Pthread");
+        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+        glMatrixMode(GL_PROJECTION);
+        gluOrtho2D(0, X_RESN, 0, Y_RESN);
+        glutDisplayFunc(plot);
+#endif
+
+        t1 = std::chrono::high_resolution_clock::now();
+    }
+
+    render_image();
+
+    if (rank == 0) {
+        t2 = std::chrono::high_resolution_clock::now();
+        time_span = t2 - t1;
+
+        printf("Student ID: 119020038\n");
+        printf("Name: Xi Mao\n");
+        printf("Assignment 2: MPI+Pthread\n");
+        printf("Run Time: %f seconds\n", time_span.count());
+        printf("Problem Size: %d * %d, %d\n", X_RESN, Y_RESN, max_iteration);
+        printf("Processing Speed: %f pixels/s\n", total_size / time_span.count());
+        printf("Process Number: %d, Thread Number: %d\n", world_size, n_thd);
+        if (print_stats) print_stats_report(worker_stats);
+
+#ifdef GUI
+        glutMainLoop();
+#endif
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
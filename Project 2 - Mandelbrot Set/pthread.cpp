@@ -1,4 +1,12 @@
 #include "asg2.h"
+#include "animation.h"
+#include "antialias.h"
+#include "iteration_cache.h"
+#include "server.h"
+#include "stats.h"
+#include "stream.h"
+#include "thread_pool.h"
+#include <atomic>
 #include <cstdio>
 #include <vector>
 #include <pthread.h>
@@ -6,46 +14,263 @@
 int n_thd; // number of threads
 
 typedef struct {
+    int thread;
     Point *begin, *end;
+    TileState *tile;  // cached iteration state, may be null
+    WorkerStats stats;
 } Args;
 
 
 void *worker(void *args) {
     Args *arg = static_cast<Args *>(args);
-    compute_block(arg->begin, arg->end);
+    pin_thread(arg->thread);
+
+    // first touch: the pages of this block are placed on this thread's node
+    init_points(arg->begin, (int) (arg->begin - data), (int) (arg->end - arg->begin));
+    const auto start = std::chrono::high_resolution_clock::now();
+    arg->stats.iterations = compute_block(arg->begin, arg->end, view, arg->tile);
+    arg->stats.seconds = seconds_since(start);
     return nullptr;
 }
 
-int main(int argc, char *argv[]) {
+std::atomic<int> next_item;  // next frame, tile or edge chunk to be taken by a thread
 
-    if (argc == 5) {
-        X_RESN = atoi(argv[1]);
-        Y_RESN = atoi(argv[2]);
-        max_iteration = atoi(argv[3]);
-        n_thd = atoi(argv[4]);
-    } else {
-        X_RESN = 800;
-        Y_RESN = 800;
-        max_iteration = 100;
-        n_thd = 4;
+/* edge pixels of the current image or frame, supersampled by all threads */
+std::vector<Point> edges;
+
+void supersample_edges(const Viewport &vp) {
+    /* edge pixels near the set cost much more than others, so take small chunks */
+    int begin;
+    const int count = (int) edges.size();
+    while ((begin = AA_CHUNK * next_item++) < count) {
+        const int end = std::min(begin + AA_CHUNK, count);
+        supersample_block(edges.data() + begin, edges.data() + end, vp);
     }
+}
 
-#ifdef GUI
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
-    glutInitWindowSize(500, 500);
-    glutInitWindowPosition(0, 0);
-    glutCreateWindow("Pthread");
-    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-    glMatrixMode(GL_PROJECTION);
-    gluOrtho2D(0, X_RESN, 0, Y_RESN);
-    glutDisplayFunc(plot);
-#endif
+void *aa_worker(void *args) {
+    pin_thread(*static_cast<int *>(args));
+    supersample_edges(view);
+    return nullptr;
+}
 
-    /* computation part begin */
+/* shared state of the animation mode */
+std::vector<Keyframe> keyframes;
+FrameWriter *writer;
+pthread_barrier_t frame_barrier;
+Frame *current_frame;  // frame rendered tile by tile
+Viewport current_view;
+int tile_size, n_tiles;
+
+void *frame_worker(void *args) {
+    /* small frames: every thread renders whole frames on its own */
+    pin_thread(*static_cast<int *>(args));
+    int f;
+    while ((f = next_item++) < n_frames) {
+        Frame *frame = writer->acquire();
+        Viewport vp = animation_viewport(keyframes, f);
+        setup_viewport(vp);
+        compute_block(frame->points.data(), frame->points.data() + total_size, vp);
+        antialias(frame->points.data(), vp);
+        frame->index = f;
+        writer->submit(frame);
+    }
+    return nullptr;
+}
+
+void *tile_worker(void *args) {
+    /* large frames: all threads share a frame, tiles are taken dynamically */
+    const int thd = *static_cast<int *>(args);
+    pin_thread(thd);
+    for (int f = 0; f < n_frames; f++) {
+        if (thd == 0) {
+            current_frame = writer->acquire();
+            current_frame->index = f;
+            current_view = animation_viewport(keyframes, f);
+            setup_viewport(current_view);
+            next_item = 0;
+        }
+        pthread_barrier_wait(&frame_barrier);
+
+        Point *points = current_frame->points.data();
+        int tile;
+        while ((tile = next_item++) < n_tiles) {
+            const int begin = tile * tile_size;
+            const int end = std::min(begin + tile_size, total_size);
+            compute_block(points + begin, points + end, current_view);
+        }
+
+        // the frame is complete once every thread is here
+        pthread_barrier_wait(&frame_barrier);
+
+        if (aa_samples > 1) {
+            if (thd == 0) {
+                edges = find_edges(points);
+                next_item = 0;
+            }
+            pthread_barrier_wait(&frame_barrier);
+            supersample_edges(current_view);
+            pthread_barrier_wait(&frame_barrier);
+            if (thd == 0) store_edges(points, edges.data(), (int) edges.size());
+        }
+
+        if (thd == 0) writer->submit(current_frame);
+    }
+    return nullptr;
+}
+
+void render_animation() {
+    /*
+    Render n_frames frames along the keyframes. Frames are handed to a
+    writer thread, so encoding and writing frame k overlaps with computing
+    the following frames.
+    */
+    keyframes = load_keyframes(keyframe_path);
+    if (keyframes.empty())
+        fprintf(stderr, "No keyframes in %s, using the default view\n", keyframe_path.c_str());
+
+    const bool whole_frames = total_size < FRAME_TILE_THRESHOLD && n_frames >= n_thd;
+    writer = new FrameWriter(whole_frames ? n_thd + 1 : 2, total_size, write_frame_pgm);
+
+    // a few tiles per thread to balance the load within a frame, whole
+    // columns so that mirrored rows stay within a tile
+    tile_size = std::max(total_size / (n_thd * 16) / Y_RESN, 1) * Y_RESN;
+    n_tiles = (total_size + tile_size - 1) / tile_size;
+    next_item = 0;
+    pthread_barrier_init(&frame_barrier, nullptr, n_thd);
+
+    std::vector<pthread_t> thds(n_thd);
+    std::vector<int> ids(n_thd);
+    for (int thd = 0; thd < n_thd; thd++) {
+        ids[thd] = thd;
+        pthread_create(&thds[thd], nullptr, whole_frames ? frame_worker : tile_worker, &ids[thd]);
+    }
+    for (int thd = 0; thd < n_thd; thd++)
+        pthread_join(thds[thd], nullptr);
+
+    writer->finish();
+    delete writer;
+    pthread_barrier_destroy(&frame_barrier);
+}
+
+void *band_worker(void *args) {
+    /* all threads share a band, chunks of columns are taken dynamically */
+    const int thd = *static_cast<int *>(args);
+    pin_thread(thd);
+    const int chunk = std::max(X_RESN / (n_thd * 16), 1);
+    const int n_chunks = (X_RESN + chunk - 1) / chunk;
+
+    for (int band = 0; band < n_bands; band++) {
+        if (thd == 0) {
+            current_frame = writer->acquire();
+            current_frame->index = band;
+            next_item = 0;
+        }
+        pthread_barrier_wait(&frame_barrier);
+
+        int y_begin, y_end;
+        band_range(band, y_begin, y_end);
+        const int rows = y_end - y_begin;
+        int item;
+        while ((item = next_item++) < n_chunks) {
+            const int x_end = std::min((item + 1) * chunk, X_RESN);
+            for (int x = item * chunk; x < x_end; x++) {
+                // a column of a band is a contiguous run of the image's column
+                Point *column = current_frame->points.data() + (size_t) x * rows;
+                init_band_column(column, x, y_begin, y_end);
+                compute_block(column, column + rows, view);
+            }
+        }
+
+        pthread_barrier_wait(&frame_barrier);
+        if (thd == 0) writer->submit(current_frame);
+    }
+    return nullptr;
+}
+
+void render_stream() {
+    /*
+    Render the image band by band into stream_path. Only STREAM_SLOTS bands
+    are in memory, the writer thread stores one while the next is computed.
+    */
+    if (!open_stream()) return;
+    setup_viewport(view);
+
+    writer = new FrameWriter(STREAM_SLOTS, X_RESN * band_rows, write_band);
+    pthread_barrier_init(&frame_barrier, nullptr, n_thd);
+
+    std::vector<pthread_t> thds(n_thd);
+    std::vector<int> ids(n_thd);
+    for (int thd = 0; thd < n_thd; thd++) {
+        ids[thd] = thd;
+        pthread_create(&thds[thd], nullptr, band_worker, &ids[thd]);
+    }
+    for (int thd = 0; thd < n_thd; thd++)
+        pthread_join(thds[thd], nullptr);
+
+    writer->finish();
+    delete writer;
+    pthread_barrier_destroy(&frame_barrier);
+    close_stream();
+}
+
+/* shared state of the server mode */
+ThreadPool *pool;
+TileState *job_tile;  // cached iteration state of the current job, may be null
+
+void render_job_tile(int tile, void *) {
+    const int begin = tile * tile_size;
+    const int end = std::min(begin + tile_size, total_size);
+    compute_block(data + begin, data + end, view, job_tile);
+}
+
+void supersample_job_chunk(int chunk, void *) {
+    const int begin = chunk * AA_CHUNK;
+    const int end = std::min(begin + AA_CHUNK, (int) edges.size());
+    supersample_block(edges.data() + begin, edges.data() + end, view);
+}
+
+void render_job() {
+    /* one server job on the warm pool, tiles are taken dynamically */
+    setup_viewport(view);
+    tile_size = std::max(total_size / (pool->size() * 16) / Y_RESN, 1) * Y_RESN;
+    n_tiles = (total_size + tile_size - 1) / tile_size;
+
+    job_tile = acquire_tile(view, 0, total_size);
+    pool->run(n_tiles, render_job_tile, nullptr);
+    release_tile(job_tile);
+
+    if (aa_samples > 1) {
+        edges = find_edges(data);
+        pool->run(((int) edges.size() + AA_CHUNK - 1) / AA_CHUNK, supersample_job_chunk, nullptr);
+        store_edges(data, edges.data(), (int) edges.size());
+    }
+}
+
+void run_server() {
+    /* jobs start from the settings of the command line */
+    const JobDefaults defaults = {X_RESN, Y_RESN, max_iteration, view, aa_samples, aa_threshold};
+    const std::string path = serve_path;
+
+    pool = new ThreadPool(n_thd);
+    pin_thread(0);
     t1 = std::chrono::high_resolution_clock::now();
+    const int jobs = serve(path, defaults, render_job);
+    t2 = std::chrono::high_resolution_clock::now();
+    time_span = t2 - t1;
+    delete pool;
+
+    // stdout may carry the images, so report on stderr
+    fprintf(stderr, "Served %d jobs in %f seconds with %d threads\n", jobs, time_span.count(),
+            n_thd);
+}
+
+std::vector<WorkerStats> worker_stats;  // of the threads of render_image()
 
-    init_data();
+void render_image() {
+    // workers initialize their own points, see worker()
+    alloc_data();
+    setup_viewport(view);
 
     std::vector<pthread_t> thds(n_thd);  // thread poll
     std::vector<Args> args(n_thd);  // arguments for all threads
@@ -66,30 +291,110 @@ int main(int argc, char *argv[]) {
         displs[i] = displs[i - 1] + send_counts[i - 1];
     }
 
+    // threads fill disjoint parts of the same cached tile
+    TileState *tile = acquire_tile(view, 0, total_size);
+
     // create threads
     for (int thd = 0; thd < n_thd; thd++) {
+        args[thd].thread = thd;
         args[thd].begin = data + displs[thd];
         args[thd].end = data + displs[thd + 1];
+        args[thd].tile = tile;
     }
     for (int thd = 0; thd < n_thd; thd++)
         pthread_create(&thds[thd], nullptr, worker, &args[thd]);
     for (int thd = 0; thd < n_thd; thd++)
         pthread_join(thds[thd], nullptr);
 
+    release_tile(tile);
+    for (int thd = 0; thd < n_thd; thd++)
+        worker_stats.push_back(args[thd].stats);
+
+    // supersample the edge pixels found in the base render
+    if (aa_samples > 1) {
+        edges = find_edges(data);
+        next_item = 0;
+        for (int thd = 0; thd < n_thd; thd++)
+            pthread_create(&thds[thd], nullptr, aa_worker, &args[thd].thread);
+        for (int thd = 0; thd < n_thd; thd++)
+            pthread_join(thds[thd], nullptr);
+        store_edges(data, edges.data(), (int) edges.size());
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    std::vector<char *> params = parse_args(argc, argv);
+    if (params.size() == 4) {
+        X_RESN = atoi(params[0]);
+        Y_RESN = atoi(params[1]);
+        max_iteration = atoi(params[2]);
+        n_thd = atoi(params[3]);
+    } else {
+        X_RESN = 800;
+        Y_RESN = 800;
+        max_iteration = 100;
+        n_thd = 4;
+    }
+
+    init_cache();
+
+    if (!serve_path.empty()) {
+        run_server();
+        free_cache();
+        return 0;
+    }
+
+#ifdef GUI
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+    glutInitWindowSize(500, 500);
+    glutInitWindowPosition(0, 0);
+    glutCreateWindow("Pthread");
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glMatrixMode(GL_PROJECTION);
+    gluOrtho2D(0, X_RESN, 0, Y_RESN);
+    glutDisplayFunc(plot);
+#endif
+
+    // streamed images never exist in memory as a whole
+    const bool streaming = !stream_path.empty();
+    const bool animating = !streaming && !keyframe_path.empty();
+
+    /* computation part begin */
+    t1 = std::chrono::high_resolution_clock::now();
+
+    if (streaming) {
+        render_stream();
+    } else if (animating) {
+        total_size = X_RESN * Y_RESN;
+        render_animation();
+    } else {
+        render_image();
+    }
+
     t2 = std::chrono::high_resolution_clock::now();
     time_span = t2 - t1;
     /* computation part end */
 
+    const int frames = animating ? n_frames : 1;
+    // a streamed image can have more pixels than an int holds
+    const long pixels = streaming ? (long) X_RESN * Y_RESN : total_size;
+
     printf("Student ID: 119020038\n");
     printf("Name: Xi Mao\n");
     printf("Assignment 2: Pthread\n");
     printf("Run Time: %f seconds\n", time_span.count());
     printf("Problem Size: %d * %d, %d\n", X_RESN, Y_RESN, max_iteration);
-    printf("Processing Speed: %f pixels/s\n", total_size / time_span.count());
+    printf("Processing Speed: %f pixels/s\n", pixels / time_span.count() * frames);
     printf("Thread Number: %d\n", n_thd);
+    if (animating) printf("Frame Number: %d\n", n_frames);
+    if (print_stats && !worker_stats.empty()) print_stats_report(worker_stats);
+
+    free_cache();
 
 #ifdef GUI
-    glutMainLoop();
+    if (!animating && !streaming) glutMainLoop();
 #endif
 
     return 0;
@@ -0,0 +1,122 @@
+"""
+Local scaling benchmark, no slurm needed. Run from the project root after
+scripts/cmake_build.sh and a build of cmake-build-release:
+
+    python3 scripts/benchmark.py --sizes 800 1600 --iterations 100 1000 \
+        --threads 1 2 4 --ranks 1 2 4
+
+Every target runs every configuration test_repeat_num times with --stats.
+The mean run time, the speedup over sequential at the same problem size,
+the efficiency (speedup per core) and the load imbalance of the workers
+(max / mean of their compute time and of their iterations) are written to
+outputs/benchmark.csv and outputs/benchmark.json.
+"""
+import argparse
+import csv
+import json
+import os
+import re
+import shlex
+import subprocess
+
+from test_profiles import test_repeat_num, dims
+
+parser = argparse.ArgumentParser(description="Mandelbrot scaling benchmark")
+parser.add_argument("--build-dir", default="cmake-build-release")
+parser.add_argument("--sizes", type=int, nargs="+", default=[x for x, _ in dims])
+parser.add_argument("--iterations", type=int, nargs="+",
+                    default=sorted(set(i for _, i in dims)))
+parser.add_argument("--threads", type=int, nargs="+", default=[1, 2, 4])
+parser.add_argument("--ranks", type=int, nargs="+", default=[1, 2, 4])
+parser.add_argument("--targets", nargs="+",
+                    default=["sequential", "pthread", "mpi", "mpi_pthread"])
+parser.add_argument("--repeat", type=int, default=test_repeat_num)
+parser.add_argument("--mpirun", default="mpirun --oversubscribe",
+                    help="launcher for the MPI targets, -np is appended")
+parser.add_argument("--extra", default="", help="more options for every run, e.g. --aa=3")
+parser.add_argument("--output", default="outputs/benchmark")
+args = parser.parse_args()
+
+
+def configurations(target):
+    """(processes, threads) of every run of a target"""
+    if target == "sequential":
+        return [(1, 1)]
+    if target == "pthread":
+        return [(1, t) for t in args.threads]
+    if target == "mpi":
+        return [(r, 1) for r in args.ranks]
+    return [(r, t) for r in args.ranks for t in args.threads]
+
+
+def command(target, size, max_iter, procs, threads):
+    cmd = [os.path.join(args.build_dir, target), str(size), str(size), str(max_iter)]
+    if target in ("pthread", "mpi_pthread"):
+        cmd.append(str(threads))
+    cmd += ["--stats"] + shlex.split(args.extra)
+    if target in ("mpi", "mpi_pthread"):
+        cmd = shlex.split(args.mpirun) + ["-np", str(procs)] + cmd
+    return cmd
+
+
+def run(cmd):
+    """run time, and seconds and iterations of every worker"""
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, universal_newlines=True,
+                         check=True).stdout
+    time_ = float(re.search(r"Run Time: (.+) seconds", out).group(1))
+    workers = [(float(s), int(i)) for s, i in
+               re.findall(r"Worker \d+: (.+) seconds, (\d+) iterations", out)]
+    return time_, workers
+
+
+def imbalance(values):
+    """max / mean, 1 if there was nothing to do"""
+    total = sum(values)
+    return max(values) * len(values) / total if total > 0 else 1.0
+
+
+results = []
+for size in args.sizes:
+    for max_iter in args.iterations:
+        sequential_time = None
+        for target in args.targets:
+            for procs, threads in configurations(target):
+                cmd = command(target, size, max_iter, procs, threads)
+                print(" ".join(cmd), flush=True)
+                runs = [run(cmd) for _ in range(args.repeat)]
+
+                time_ = sum(t for t, _ in runs) / len(runs)
+                if target == "sequential":
+                    sequential_time = time_
+                cores = procs * threads
+                speedup = sequential_time / time_ if sequential_time else None
+                results.append({
+                    "target": target,
+                    "processes": procs,
+                    "threads": threads,
+                    "cores": cores,
+                    "size": size,
+                    "max_iteration": max_iter,
+                    "time": time_,
+                    "speed": size * size / time_,
+                    "speedup": speedup,
+                    "efficiency": speedup / cores if speedup else None,
+                    "time_imbalance":
+                        sum(imbalance([s for s, _ in w]) for _, w in runs) / len(runs),
+                    "iteration_imbalance":
+                        sum(imbalance([i for _, i in w]) for _, w in runs) / len(runs),
+                    "worker_seconds": [s for s, _ in runs[-1][1]],
+                    "worker_iterations": [i for _, i in runs[-1][1]],
+                })
+
+os.makedirs(os.path.dirname(args.output) or ".", exist_ok=True)
+columns = ["target", "processes", "threads", "cores", "size", "max_iteration", "time",
+           "speed", "speedup", "efficiency", "time_imbalance", "iteration_imbalance"]
+with open(args.output + ".csv", "w", newline="") as f:
+    writer = csv.DictWriter(f, fieldnames=columns, extrasaction="ignore")
+    writer.writeheader()
+    writer.writerows(results)
+with open(args.output + ".json", "w") as f:
+    json.dump(results, f, indent=2)
+
+print(f"Wrote {args.output}.csv and {args.output}.json")
@@ -32,6 +32,10 @@ for file in os.listdir(out_dir):
         elif type_ == "Pthread":
             num_cores = re.match(r"Thread Number: (\d+)", content[6]).groups()[0]
             sta.write(f"Pthread, {num_cores}, {num}, {time_}, {speed}\n")
+        # mpi + pthread, cores are processes x threads
+        elif type_ == "MPI+Pthread":
+            procs, threads = re.match(r"Process Number: (\d+), Thread Number: (\d+)", content[6]).groups()
+            sta.write(f"MPI+Pthread, {int(procs) * int(threads)}, {num}, {time_}, {speed}\n")
         # mpi
         else:
             num_cores = re.match(r"Process Number: (\d+)", content[6]).groups()[0]
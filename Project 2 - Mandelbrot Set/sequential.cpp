@@ -1,28 +1,39 @@
 #include "asg2.h"
+#include "antialias.h"
+#include "iteration_cache.h"
+#include "stats.h"
 #include <cstdio>
 
 
+WorkerStats stats;
+
 void sequentialCompute() {
     /* compute for all points one by one */
-    Point *p = data;
-    for (int index = 0; index < total_size; index++) {
-        compute(p);
-        p++;
-    }
+    const auto start = std::chrono::high_resolution_clock::now();
+    TileState *tile = acquire_tile(view, 0, total_size);
+    stats.iterations = compute_block(data, data + total_size, view, tile);
+    release_tile(tile);
+    stats.seconds = seconds_since(start);
+
+    /* supersample the edge pixels found in the base render */
+    antialias(data, view);
 }
 
 int main(int argc, char *argv[]) {
     /* pass in metadata for computation */
-    if (argc == 4) {
-        X_RESN = atoi(argv[1]);
-        Y_RESN = atoi(argv[2]);
-        max_iteration = atoi(argv[3]);
+    std::vector<char *> params = parse_args(argc, argv);
+    if (params.size() == 3) {
+        X_RESN = atoi(params[0]);
+        Y_RESN = atoi(params[1]);
+        max_iteration = atoi(params[2]);
     } else {
         X_RESN = 800;
         Y_RESN = 800;
         max_iteration = 100;
     }
 
+    init_cache();
+
 #ifdef GUI
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
@@ -38,6 +49,7 @@ int main(int argc, char *argv[]) {
     /* computation part begin */
     t1 = std::chrono::high_resolution_clock::now();
     init_data();
+    setup_viewport(view);
     sequentialCompute();
     t2 = std::chrono::high_resolution_clock::now();
     time_span = t2 - t1;
@@ -50,6 +62,9 @@ int main(int argc, char *argv[]) {
     printf("Problem Size: %d * %d, %d\n", X_RESN, Y_RESN, max_iteration);
     printf("Processing Speed: %f pixels/s\n", total_size / time_span.count());
     printf("Process Number: %d\n", 1);
+    if (print_stats) print_stats_report(std::vector<WorkerStats>(1, stats));
+
+    free_cache();
 
 #ifdef GUI
     glutMainLoop();
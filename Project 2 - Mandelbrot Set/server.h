@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "asg2.h"
+#include "animation.h"
+
+/*
+Render server.
+A long-running process reads render jobs, one per line,
+
+    [<X_RESN> <Y_RESN> <max_iteration>] [--key=value ...]
+
+with the same options as the command line, and answers each with a binary
+PGM image ("P5 <width> <height> 255" followed by the pixels), or with a line
+"ERR <reason>" for a job it cannot render. Omitted values are taken from the
+server's own command line. The frame buffer is reused between jobs, so a job
+costs little more than its computation.
+*/
+
+/* render the job described by X_RESN, Y_RESN, max_iteration and view into data */
+typedef void (*RenderJobFunc)();
+
+/* largest frame a job may ask for */
+const long SERVER_MAX_PIXELS = 1L << 26;
+
+/* the settings jobs start from */
+struct JobDefaults {
+    int x_resn, y_resn, max_iteration;
+    Viewport view;
+    int aa_samples, aa_threshold;
+};
+
+/* points allocated in data, and the resolution their coordinates are set up for */
+int frame_capacity = 0;
+int frame_x_resn = 0, frame_y_resn = 0;
+
+void resize_frame() {
+    /* keep data across jobs, the point coordinates only change with the resolution */
+    total_size = X_RESN * Y_RESN;
+    if (total_size > frame_capacity) {
+        delete[] data;
+        data = new Point[total_size];
+        frame_capacity = total_size;
+        frame_x_resn = 0;
+    }
+    if (frame_x_resn != X_RESN || frame_y_resn != Y_RESN) {
+        init_points(data, 0, total_size);
+        frame_x_resn = X_RESN;
+        frame_y_resn = Y_RESN;
+    }
+}
+
+bool parse_job(const std::string& line, const JobDefaults& defaults, std::string& error) {
+    /* set the globals for one job line, starting from the defaults */
+    std::istringstream ss(line);
+    std::vector<std::string> words;
+    std::string word;
+    while (ss >> word) words.push_back(word);
+
+    std::vector<char*> argv(1, const_cast<char*>("job"));
+    for (size_t i = 0; i < words.size(); i++) argv.push_back(&words[i][0]);
+
+    view = defaults.view;
+    aa_samples = defaults.aa_samples;
+    aa_threshold = defaults.aa_threshold;
+    std::vector<char*> params = parse_args((int) argv.size(), argv.data());
+
+    if (params.size() == 3) {
+        X_RESN = atoi(params[0]);
+        Y_RESN = atoi(params[1]);
+        max_iteration = atoi(params[2]);
+    } else if (params.empty()) {
+        X_RESN = defaults.x_resn;
+        Y_RESN = defaults.y_resn;
+        max_iteration = defaults.max_iteration;
+    } else {
+        error = "expected <X_RESN> <Y_RESN> <max_iteration>";
+        return false;
+    }
+
+    if (X_RESN <= 0 || Y_RESN <= 0 || max_iteration <= 0) {
+        error = "resolution and max_iteration must be positive";
+        return false;
+    }
+    if ((long) X_RESN * Y_RESN > SERVER_MAX_PIXELS) {
+        error = "frame too large";
+        return false;
+    }
+    return true;
+}
+
+int serve_stream(FILE* in, FILE* out, const JobDefaults& defaults, RenderJobFunc render) {
+    /* answer the jobs read from in until end of file, return how many were rendered */
+    std::vector<unsigned char> pixels;
+    std::string line, error;
+    int jobs = 0;
+    char buffer[4096];
+
+    while (fgets(buffer, sizeof(buffer), in) != nullptr) {
+        line = buffer;
+        if (line.find_first_not_of(" \t\r\n") == std::string::npos) continue;
+
+        if (!parse_job(line, defaults, error)) {
+            fprintf(out, "ERR %s\n", error.c_str());
+            fflush(out);
+            continue;
+        }
+
+        resize_frame();
+        render();
+
+        pixels.resize(total_size);
+        encode_rows(data, 0, Y_RESN, pixels.data());
+        fprintf(out, "P5\n%d %d\n255\n", X_RESN, Y_RESN);
+        fwrite(pixels.data(), 1, pixels.size(), out);
+        if (fflush(out) != 0) break; // the client went away
+        jobs++;
+    }
+    return jobs;
+}
+
+int serve(const std::string& path, const JobDefaults& defaults, RenderJobFunc render) {
+    /*
+    Serve jobs from stdin to stdout if path is "-", otherwise from clients of
+    a Unix domain socket at path, one connection after another, until the
+    process is stopped. Return the number of jobs rendered.
+    */
+    if (path == "-") return serve_stream(stdin, stdout, defaults, render);
+
+    // a client that disconnects early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return 0;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listener < 0 || bind(listener, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(listener, 8) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path.c_str(), strerror(errno));
+        if (listener >= 0) close(listener);
+        return 0;
+    }
+
+    int jobs = 0;
+    while (true) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "accept: %s\n", strerror(errno));
+            break;
+        }
+        FILE* in = fdopen(fd, "r");
+        FILE* out = fdopen(dup(fd), "w");
+        jobs += serve_stream(in, out, defaults, render);
+        fclose(out);
+        fclose(in);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    return jobs;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+/*
+Per-worker statistics, printed after the summary when --stats is given.
+A worker is a thread of pthread, a rank of mpi and mpi_pthread, and the
+only process of sequential. The load imbalance of a quantity is its maximum
+over the workers divided by its mean: 1 is a perfect balance, and the run
+time of the base render is about the imbalance times the ideal one.
+scripts/benchmark.py reads these lines.
+*/
+
+struct WorkerStats {
+    double seconds;  // time spent computing points in the base render
+    long iterations; // escape-time iterations executed
+};
+
+double seconds_since(std::chrono::high_resolution_clock::time_point start) {
+    std::chrono::duration<double> span = std::chrono::high_resolution_clock::now() - start;
+    return span.count();
+}
+
+double imbalance(double max, double sum, int n) {
+    /* max / mean, 1 if there was nothing to do */
+    return sum > 0 ? max * n / sum : 1.0;
+}
+
+void print_stats_report(const std::vector<WorkerStats>& workers) {
+    double max_seconds = 0, sum_seconds = 0;
+    long max_iterations = 0, sum_iterations = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        printf("Worker %d: %f seconds, %ld iterations\n", (int) i, workers[i].seconds,
+               workers[i].iterations);
+        max_seconds = std::max(max_seconds, workers[i].seconds);
+        sum_seconds += workers[i].seconds;
+        max_iterations = std::max(max_iterations, workers[i].iterations);
+        sum_iterations += workers[i].iterations;
+    }
+
+    const int n = (int) workers.size();
+    printf("Load Imbalance: %f (time), %f (iterations)\n",
+           imbalance(max_seconds, sum_seconds, n),
+           imbalance((double) max_iterations, (double) sum_iterations, n));
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+#include "asg2.h"
+#include "animation.h"
+
+/*
+Band streaming for images larger than memory.
+The image is rendered in horizontal bands of band_rows rows, from the top
+down. A band is stored column major like data, every column holding the
+band's rows only. Finished bands are appended to a PGM file, in order, by a
+FrameWriter thread while the next band is computed, so memory stays at a
+few bands whatever the size of the image.
+*/
+
+/* points per band, 12 MB */
+const int STREAM_BAND_POINTS = 1 << 20;
+
+/* band buffers: one being computed, one being written and one spare */
+const int STREAM_SLOTS = 3;
+
+FILE* stream_file;
+int band_rows, n_bands;
+
+void band_range(int band, int& y_begin, int& y_end) {
+    /* band 0 is the top of the image, i.e. holds the largest y */
+    y_end = Y_RESN - band * band_rows;
+    y_begin = std::max(y_end - band_rows, 0);
+}
+
+bool open_stream() {
+    /* create the output file and write its header */
+    band_rows = std::max(1, std::min(Y_RESN, STREAM_BAND_POINTS / X_RESN));
+    n_bands = (Y_RESN + band_rows - 1) / band_rows;
+
+    stream_file = fopen(stream_path.c_str(), "wb");
+    if (stream_file == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", stream_path.c_str());
+        return false;
+    }
+    fprintf(stream_file, "P5\n%d %d\n255\n", X_RESN, Y_RESN);
+    return true;
+}
+
+void close_stream() {
+    fclose(stream_file);
+}
+
+void init_band_column(Point* column, int x, int y_begin, int y_end) {
+    /* set the coordinates of column x of a band */
+    for (int y = y_begin; y < y_end; y++, column++) {
+        column->x = x;
+        column->y = y;
+    }
+}
+
+void write_band(const Frame& band) {
+    /* append a band as top-down rows, runs on the writer thread */
+    static std::vector<unsigned char> pixels;
+    int y_begin, y_end;
+    band_range(band.index, y_begin, y_end);
+    const int rows = y_end - y_begin;
+
+    pixels.resize((size_t) X_RESN * rows);
+    unsigned char* out = pixels.data();
+    for (int y = rows - 1; y >= 0; y--)
+        for (int x = 0; x < X_RESN; x++)
+            *out++ = to_gray(band.points[(size_t) x * rows + y].color);
+
+    if (fwrite(pixels.data(), 1, pixels.size(), stream_file) != pixels.size())
+        fprintf(stderr, "Cannot write band %d to %s\n", band.index, stream_path.c_str());
+}
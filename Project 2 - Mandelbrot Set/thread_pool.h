@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+#include "affinity.h"
+
+/* process item number item of a parallel loop */
+typedef void (*TaskFunc)(int item, void* arg);
+
+class ThreadPool {
+    /*
+    Threads that are created once and then wait for work, so a render costs
+    no pthread_create() / pthread_join(). run() hands out the items of a
+    parallel loop dynamically; the calling thread works on them as well, so
+    a pool of n threads has n - 1 workers, pinned as threads 1 ... n - 1 of
+    the affinity policy; the caller should pin itself as thread 0.
+    */
+public:
+    explicit ThreadPool(int n_threads) :
+        threads(n_threads > 1 ? n_threads - 1 : 0), generation(0), running(0), stop(false),
+        func(nullptr), arg(nullptr), n_items(0), started(0) {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&start_cond, nullptr);
+        pthread_cond_init(&done_cond, nullptr);
+        for (size_t i = 0; i < threads.size(); i++)
+            pthread_create(&threads[i], nullptr, worker_main, this);
+    }
+
+    ~ThreadPool() {
+        pthread_mutex_lock(&mutex);
+        stop = true;
+        pthread_cond_broadcast(&start_cond);
+        pthread_mutex_unlock(&mutex);
+        for (size_t i = 0; i < threads.size(); i++)
+            pthread_join(threads[i], nullptr);
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&start_cond);
+        pthread_cond_destroy(&done_cond);
+    }
+
+    int size() const {
+        return (int) threads.size() + 1;
+    }
+
+    void run(int count, TaskFunc task, void* task_arg) {
+        /* call task(i, task_arg) for i in [0, count) and return when all are done */
+        pthread_mutex_lock(&mutex);
+        func = task;
+        arg = task_arg;
+        n_items = count;
+        next_item = 0;
+        running = (int) threads.size();
+        generation++;
+        pthread_cond_broadcast(&start_cond);
+        pthread_mutex_unlock(&mutex);
+
+        work();
+
+        pthread_mutex_lock(&mutex);
+        while (running > 0)
+            pthread_cond_wait(&done_cond, &mutex);
+        pthread_mutex_unlock(&mutex);
+    }
+
+private:
+    void work() {
+        int item;
+        while ((item = next_item++) < n_items)
+            func(item, arg);
+    }
+
+    static void* worker_main(void* self_arg) {
+        ThreadPool* self = static_cast<ThreadPool*>(self_arg);
+        pin_thread(++self->started);
+        int seen = 0;
+        pthread_mutex_lock(&self->mutex);
+        while (true) {
+            while (self->generation == seen && !self->stop)
+                pthread_cond_wait(&self->start_cond, &self->mutex);
+            if (self->stop) break;
+            seen = self->generation;
+            pthread_mutex_unlock(&self->mutex);
+
+            self->work();
+
+            pthread_mutex_lock(&self->mutex);
+            if (--self->running == 0) pthread_cond_signal(&self->done_cond);
+        }
+        pthread_mutex_unlock(&self->mutex);
+        return nullptr;
+    }
+
+    std::vector<pthread_t> threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond;
+    int generation; // number of run() calls, wakes the workers
+    int running;    // workers still busy with the current run()
+    bool stop;
+
+    TaskFunc func;
+    void* arg;
+    int n_items;
+    std::atomic<int> next_item;
+    std::atomic<int> started; // workers numbered so far
+};
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "barnes_hut.h"
+
+void BarnesHut::build_top(const std::vector<double>& m, const std::vector<Point>& pos,
+                          const size_t n) {
+    mass = &m;
+    position = &pos;
+
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) order[i] = static_cast<int>(i);
+
+    // the root is the bounding square of all bodies
+    Vector lo{0, 0}, hi{0, 0};
+    if (n > 0) lo = hi = pos[0];
+    for (size_t i = 1; i < n; ++i) {
+        lo.x = std::min(lo.x, pos[i].x);
+        lo.y = std::min(lo.y, pos[i].y);
+        hi.x = std::max(hi.x, pos[i].x);
+        hi.y = std::max(hi.y, pos[i].y);
+    }
+    Node root{};
+    root.center.x = (lo.x + hi.x) / 2;
+    root.center.y = (lo.y + hi.y) / 2;
+    root.half = std::max(std::max(hi.x - lo.x, hi.y - lo.y) / 2, FLOAT_OP_ERROR);
+    root.first_child = -1;
+    root.begin = 0;
+    root.end = static_cast<int>(n);
+
+    nodes.assign(1, root);
+    cells.clear();
+
+    // split level by level, the nodes of a level are contiguous
+    size_t level_begin = 0;
+    for (int depth = 0; depth < TOP_DEPTH; ++depth) {
+        const size_t level_end = nodes.size();
+        for (size_t node = level_begin; node < level_end; ++node) {
+            if (nodes[node].end - nodes[node].begin > LEAF_SIZE) split(nodes, node, depth, false);
+        }
+        level_begin = level_end;
+    }
+
+    // the remaining crowded nodes are built as separate subtrees
+    for (size_t node = level_begin; node < nodes.size(); ++node) {
+        if (nodes[node].end - nodes[node].begin > LEAF_SIZE) {
+            cells.push_back(Cell{static_cast<int>(node), {}});
+        }
+    }
+    n_top = nodes.size();
+}
+
+void BarnesHut::build_cell(const size_t cell) {
+    std::vector<Node>& local = cells[cell].nodes;
+    local.assign(1, nodes[cells[cell].node]);
+    split(local, 0, TOP_DEPTH, true);
+    // children come after their parent, so summarize back to front
+    for (size_t node = local.size(); node-- > 0;) summarize(local, node);
+}
+
+void BarnesHut::build_finish() {
+    // append the subtrees, their local node 0 replaces the top node
+    for (const Cell& cell : cells) {
+        const int offset = static_cast<int>(nodes.size()) - 1;
+        const auto remap = [offset](Node node) {
+            if (node.first_child >= 0) node.first_child += offset;
+            return node;
+        };
+        nodes[cell.node] = remap(cell.nodes[0]);
+        for (size_t node = 1; node < cell.nodes.size(); ++node) {
+            nodes.push_back(remap(cell.nodes[node]));
+        }
+    }
+    for (size_t node = n_top; node-- > 0;) summarize(nodes, node);
+
+    slot.resize(order.size());
+    for (size_t k = 0; k < order.size(); ++k) slot[order[k]] = static_cast<int>(k);
+}
+
+void BarnesHut::build(const std::vector<double>& m, const std::vector<Point>& pos,
+                      const size_t n) {
+    build_top(m, pos, n);
+    for (size_t cell = 0; cell < n_cells(); ++cell) build_cell(cell);
+    build_finish();
+}
+
+void BarnesHut::split(std::vector<Node>& tree, const size_t node, const int depth,
+                      const bool recurse) {
+    const std::vector<Point>& pos = *position;
+    const Node parent = tree[node];
+
+    // quadrant q = (x right of center) + 2 * (y above center)
+    int* const first = order.data() + parent.begin;
+    int* const last = order.data() + parent.end;
+    int* const upper =
+        std::partition(first, last, [&](int i) { return pos[i].y < parent.center.y; });
+    int* const bounds[5] = {
+        first,
+        std::partition(first, upper, [&](int i) { return pos[i].x < parent.center.x; }),
+        upper,
+        std::partition(upper, last, [&](int i) { return pos[i].x < parent.center.x; }),
+        last,
+    };
+
+    const int first_child = static_cast<int>(tree.size());
+    tree[node].first_child = first_child;
+    const double half = parent.half / 2;
+    for (int q = 0; q < 4; ++q) {
+        Node child{};
+        child.center.x = parent.center.x + (q & 1 ? half : -half);
+        child.center.y = parent.center.y + (q & 2 ? half : -half);
+        child.half = half;
+        child.first_child = -1;
+        child.begin = static_cast<int>(bounds[q] - order.data());
+        child.end = static_cast<int>(bounds[q + 1] - order.data());
+        tree.push_back(child);
+    }
+
+    if (!recurse || depth + 1 >= MAX_DEPTH) return;
+    for (int q = 0; q < 4; ++q) {
+        const size_t child = first_child + q;
+        if (tree[child].end - tree[child].begin > LEAF_SIZE) split(tree, child, depth + 1, true);
+    }
+}
+
+void BarnesHut::summarize(std::vector<Node>& tree, const size_t node) {
+    // mass and center of mass, from the bodies of a leaf or the children of a cell
+    Node& cell = tree[node];
+    Vector moment{0, 0};
+    cell.mass = 0;
+    if (cell.first_child < 0) {
+        const std::vector<double>& m = *mass;
+        const std::vector<Point>& pos = *position;
+        for (int k = cell.begin; k < cell.end; ++k) {
+            const int i = order[k];
+            cell.mass += m[i];
+            moment += pos[i] * m[i];
+        }
+    }
+    else {
+        for (int q = 0; q < 4; ++q) {
+            const Node& child = tree[cell.first_child + q];
+            cell.mass += child.mass;
+            moment += child.mass_center * child.mass;
+        }
+    }
+    if (cell.mass > 0) {
+        cell.mass_center.x = moment.x / cell.mass;
+        cell.mass_center.y = moment.y / cell.mass;
+    }
+    else {
+        cell.mass_center = cell.center;
+    }
+}
+
+Force BarnesHut::get_force(const size_t i, const double theta) const {
+    const std::vector<double>& m = *mass;
+    const std::vector<Point>& pos = *position;
+    const Point& p = pos[i];
+    const int k = slot[i];
+
+    Force f{};
+    int stack[3 * MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (node.begin == node.end) continue;
+
+        if (node.first_child < 0) {
+            // leaves are summed directly
+            for (int l = node.begin; l < node.end; ++l) {
+                const int j = order[l];
+                if (j != static_cast<int>(i)) f += ::get_force(m[i], m[j], p, pos[j]);
+            }
+            continue;
+        }
+
+        // far enough, and not holding body i itself: one pseudo body
+        const double size = 2 * node.half;
+        const bool holds_i = node.begin <= k && k < node.end;
+        if (!holds_i && size * size < theta * theta * p.sqr_dist(node.mass_center)) {
+            f += ::get_force(m[i], node.mass, p, node.mass_center);
+            continue;
+        }
+        for (int q = 3; q >= 0; --q) stack[top++] = node.first_child + q;
+    }
+    return f;
+}
+
+void update_velocity(const BarnesHut& tree, const std::vector<double>& m,
+                     std::vector<Velocity>& v, const size_t i, const double theta) {
+    const Force f = tree.get_force(i, theta);
+    // v += at
+    v[i] += (f / m[i]) * DT;
+}
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "bodies.h"
+#include "common.h"
+
+void Bodies::load_masses(const std::vector<double>& masses, const size_t n) {
+    x.resize(n);
+    y.resize(n);
+    m.assign(masses.begin(), masses.begin() + n);
+    if (precision == Precision::Double) {
+        xf.clear();
+        yf.clear();
+        mf.clear();
+    }
+    else {
+        xf.resize(n);
+        yf.resize(n);
+        mf.resize(n);
+        load_floats(0, n);
+    }
+}
+
+void Bodies::load_positions(const std::vector<Point>& pos, const size_t begin,
+                            const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        x[i] = pos[i].x;
+        y[i] = pos[i].y;
+    }
+    if (xf.empty()) return;
+    for (size_t i = begin; i < end; ++i) {
+        xf[i] = static_cast<float>(pos[i].x);
+        yf[i] = static_cast<float>(pos[i].y);
+    }
+}
+
+void Bodies::resize(const size_t n) {
+    x.resize(n);
+    y.resize(n);
+    m.resize(n);
+    if (precision != Precision::Double) {
+        xf.resize(n);
+        yf.resize(n);
+        mf.resize(n);
+    }
+}
+
+void Bodies::load_floats(const size_t begin, const size_t end) {
+    if (xf.empty()) return;
+    for (size_t i = begin; i < end; ++i) {
+        xf[i] = static_cast<float>(x[i]);
+        yf[i] = static_cast<float>(y[i]);
+        mf[i] = static_cast<float>(m[i]);
+    }
+}
+
+void Forces::clear(const size_t n) {
+    // float forces are added up in float, mixed ones in double
+    if (precision == Precision::Float) {
+        xf.assign(n, 0);
+        yf.assign(n, 0);
+        x.clear();
+        y.clear();
+    }
+    else {
+        x.assign(n, 0);
+        y.assign(n, 0);
+        xf.clear();
+        yf.clear();
+    }
+}
+
+namespace {
+
+// G m_i m_j / (r^2 + e) / r, the force along (dx, dy) is this times (dx, dy), see get_force()
+template <typename Real>
+inline Real force_scale(const Real gm_i, const Real m_j, const Real r_sqr) {
+    // bodies at the same position pull in no direction
+    if (r_sqr == 0) return 0;
+    return gm_i * m_j / (r_sqr + static_cast<Real>(FLOAT_OP_ERROR)) / std::sqrt(r_sqr);
+}
+
+/*
+ * One vector of doubles, one of floats of the same size, and the operations
+ * the kernels need. The inverse square root starts from the hardware
+ * estimate (14 bits on AVX-512, 12 bits of a float on AVX2) and is refined
+ * by Newton steps y = y (3 - x y^2) / 2, each of which doubles the correct
+ * bits, to double or float precision.
+ */
+#if defined(__AVX512F__)
+#define FORCE_KERNEL_SIMD
+constexpr const char* ISA = "AVX-512";
+constexpr size_t WIDTH = 8;
+using vdouble = __m512d;
+
+inline vdouble vset(const double a) { return _mm512_set1_pd(a); }
+inline vdouble vload(const double* p) { return _mm512_loadu_pd(p); }
+inline void vstore(double* p, const vdouble a) { _mm512_storeu_pd(p, a); }
+inline vdouble vadd(const vdouble a, const vdouble b) { return _mm512_add_pd(a, b); }
+inline vdouble vsub(const vdouble a, const vdouble b) { return _mm512_sub_pd(a, b); }
+inline vdouble vmul(const vdouble a, const vdouble b) { return _mm512_mul_pd(a, b); }
+inline vdouble vdiv(const vdouble a, const vdouble b) { return _mm512_div_pd(a, b); }
+inline vdouble vfmadd(const vdouble a, const vdouble b, const vdouble c) {
+    return _mm512_fmadd_pd(a, b, c);
+}
+inline vdouble vfnmadd(const vdouble a, const vdouble b, const vdouble c) {
+    return _mm512_fnmadd_pd(a, b, c);
+}
+inline double vsum(const vdouble a) { return _mm512_reduce_add_pd(a); }
+
+inline vdouble vrsqrt(const vdouble x) {
+    // 1 / sqrt(x), 0 where x is 0
+    const vdouble half_x = vmul(x, vset(0.5));
+    vdouble y = _mm512_rsqrt14_pd(x);
+    for (int step = 0; step < 2; ++step) {
+        y = vmul(y, _mm512_fnmadd_pd(vmul(half_x, y), y, vset(1.5)));
+    }
+    const __mmask8 nonzero = _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_NEQ_OQ);
+    return _mm512_maskz_mov_pd(nonzero, y);
+}
+
+using vfloat = __m512;
+
+inline vfloat vset(const float a) { return _mm512_set1_ps(a); }
+inline vfloat vload(const float* p) { return _mm512_loadu_ps(p); }
+inline void vstore(float* p, const vfloat a) { _mm512_storeu_ps(p, a); }
+inline vfloat vadd(const vfloat a, const vfloat b) { return _mm512_add_ps(a, b); }
+inline vfloat vsub(const vfloat a, const vfloat b) { return _mm512_sub_ps(a, b); }
+inline vfloat vmul(const vfloat a, const vfloat b) { return _mm512_mul_ps(a, b); }
+inline vfloat vdiv(const vfloat a, const vfloat b) { return _mm512_div_ps(a, b); }
+inline vfloat vfmadd(const vfloat a, const vfloat b, const vfloat c) {
+    return _mm512_fmadd_ps(a, b, c);
+}
+inline vfloat vfnmadd(const vfloat a, const vfloat b, const vfloat c) {
+    return _mm512_fnmadd_ps(a, b, c);
+}
+inline float vsum(const vfloat a) { return _mm512_reduce_add_ps(a); }
+
+inline vfloat vrsqrt(const vfloat x) {
+    // 1 / sqrt(x), 0 where x is 0
+    const vfloat half_x = vmul(x, vset(0.5f));
+    vfloat y = _mm512_rsqrt14_ps(x);
+    y = vmul(y, _mm512_fnmadd_ps(vmul(half_x, y), y, vset(1.5f)));
+    const __mmask16 nonzero = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_NEQ_OQ);
+    return _mm512_maskz_mov_ps(nonzero, y);
+}
+
+// the low and the high half of the floats as doubles
+inline vdouble vlow(const vfloat a) { return _mm512_cvtps_pd(_mm512_castps512_ps256(a)); }
+inline vdouble vhigh(const vfloat a) {
+    return _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+#define FORCE_KERNEL_SIMD
+constexpr const char* ISA = "AVX2";
+constexpr size_t WIDTH = 4;
+using vdouble = __m256d;
+
+inline vdouble vset(const double a) { return _mm256_set1_pd(a); }
+inline vdouble vload(const double* p) { return _mm256_loadu_pd(p); }
+inline void vstore(double* p, const vdouble a) { _mm256_storeu_pd(p, a); }
+inline vdouble vadd(const vdouble a, const vdouble b) { return _mm256_add_pd(a, b); }
+inline vdouble vsub(const vdouble a, const vdouble b) { return _mm256_sub_pd(a, b); }
+inline vdouble vmul(const vdouble a, const vdouble b) { return _mm256_mul_pd(a, b); }
+inline vdouble vdiv(const vdouble a, const vdouble b) { return _mm256_div_pd(a, b); }
+inline vdouble vfmadd(const vdouble a, const vdouble b, const vdouble c) {
+    return _mm256_fmadd_pd(a, b, c);
+}
+inline vdouble vfnmadd(const vdouble a, const vdouble b, const vdouble c) {
+    return _mm256_fnmadd_pd(a, b, c);
+}
+inline double vsum(const vdouble a) {
+    const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+inline vdouble vrsqrt(const vdouble x) {
+    // 1 / sqrt(x), 0 where x is 0
+    const vdouble half_x = vmul(x, vset(0.5));
+    vdouble y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(x)));
+    for (int step = 0; step < 3; ++step) {
+        y = vmul(y, _mm256_fnmadd_pd(vmul(half_x, y), y, vset(1.5)));
+    }
+    const vdouble nonzero = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_NEQ_OQ);
+    return _mm256_and_pd(nonzero, y);
+}
+
+using vfloat = __m256;
+
+inline vfloat vset(const float a) { return _mm256_set1_ps(a); }
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, const vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat vadd(const vfloat a, const vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(const vfloat a, const vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(const vfloat a, const vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(const vfloat a, const vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vfmadd(const vfloat a, const vfloat b, const vfloat c) {
+    return _mm256_fmadd_ps(a, b, c);
+}
+inline vfloat vfnmadd(const vfloat a, const vfloat b, const vfloat c) {
+    return _mm256_fnmadd_ps(a, b, c);
+}
+inline float vsum(const vfloat a) {
+    __m128 quad = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+    return _mm_cvtss_f32(_mm_add_ss(quad, _mm_shuffle_ps(quad, quad, 1)));
+}
+
+inline vfloat vrsqrt(const vfloat x) {
+    // 1 / sqrt(x), 0 where x is 0
+    const vfloat half_x = vmul(x, vset(0.5f));
+    vfloat y = _mm256_rsqrt_ps(x);
+    y = vmul(y, _mm256_fnmadd_ps(vmul(half_x, y), y, vset(1.5f)));
+    const vfloat nonzero = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+    return _mm256_and_ps(nonzero, y);
+}
+
+// the low and the high half of the floats as doubles
+inline vdouble vlow(const vfloat a) { return _mm256_cvtps_pd(_mm256_castps256_ps128(a)); }
+inline vdouble vhigh(const vfloat a) { return _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)); }
+#else
+constexpr const char* ISA = "scalar";
+#endif
+
+#ifdef FORCE_KERNEL_SIMD
+// the vector of Real and the bodies it holds
+template <typename Real>
+struct Simd;
+template <>
+struct Simd<double> {
+    using type = vdouble;
+    static constexpr size_t width = WIDTH;
+};
+template <>
+struct Simd<float> {
+    using type = vfloat;
+    static constexpr size_t width = 2 * WIDTH;
+};
+
+template <typename Real>
+inline typename Simd<Real>::type vforce_scale(const typename Simd<Real>::type gm_i,
+                                              const typename Simd<Real>::type m_j,
+                                              const typename Simd<Real>::type r_sqr) {
+    // force_scale() of a vector of bodies j
+    const auto f = vdiv(vmul(gm_i, m_j), vadd(r_sqr, vset(static_cast<Real>(FLOAT_OP_ERROR))));
+    return vmul(f, vrsqrt(r_sqr));
+}
+
+// p[0, width) -= a b, in the precision of p
+inline void vsubtract(double* p, const vdouble a, const vdouble b) {
+    vstore(p, vfnmadd(a, b, vload(p)));
+}
+inline void vsubtract(float* p, const vfloat a, const vfloat b) {
+    vstore(p, vfnmadd(a, b, vload(p)));
+}
+inline void vsubtract(double* p, const vfloat a, const vfloat b) {
+    const vfloat ab = vmul(a, b);
+    vstore(p, vsub(vload(p), vlow(ab)));
+    vstore(p + WIDTH, vsub(vload(p + WIDTH), vhigh(ab)));
+}
+
+// the force of one body i along a row: sums of a b in vectors of Acc
+template <typename Real, typename Acc>
+struct RowSum {
+    typename Simd<Real>::type sum = vset(Real(0));
+
+    void add(const typename Simd<Real>::type a, const typename Simd<Real>::type b) {
+        sum = vfmadd(a, b, sum);
+    }
+    Acc total() const { return vsum(sum); }
+};
+
+// float products added up in the double halves of the vector, as vsubtract() does
+template <>
+struct RowSum<float, double> {
+    vdouble low = vset(0.0), high = vset(0.0);
+
+    void add(const vfloat a, const vfloat b) {
+        const vfloat ab = vmul(a, b);
+        low = vadd(low, vlow(ab));
+        high = vadd(high, vhigh(ab));
+    }
+    double total() const { return vsum(vadd(low, high)); }
+};
+#endif
+
+// the arrays the kernels read and write in precision Real
+inline void get_arrays(const Bodies& bodies, const double*& x, const double*& y,
+                       const double*& m) {
+    x = bodies.x.data();
+    y = bodies.y.data();
+    m = bodies.m.data();
+}
+inline void get_arrays(const Bodies& bodies, const float*& x, const float*& y,
+                       const float*& m) {
+    x = bodies.xf.data();
+    y = bodies.yf.data();
+    m = bodies.mf.data();
+}
+inline void get_arrays(Forces& f, double*& x, double*& y) {
+    x = f.x.data();
+    y = f.y.data();
+}
+inline void get_arrays(Forces& f, float*& x, float*& y) {
+    x = f.xf.data();
+    y = f.yf.data();
+}
+
+// bytes of one body j in a tile: x, y, m and the two force components
+size_t body_bytes() {
+    if (precision == Precision::Float) return 5 * sizeof(float);
+    if (precision == Precision::Mixed) return 3 * sizeof(float) + 2 * sizeof(double);
+    return 5 * sizeof(double);
+}
+
+size_t cache_size(const int level, const size_t fallback) {
+    // sysconf() reports 0 or -1 where the size is unknown
+    long size = 0;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : _SC_LEVEL2_CACHE_SIZE);
+#endif
+    return size > 0 ? static_cast<size_t>(size) : fallback;
+}
+
+size_t round_to_width(const size_t bodies) {
+    // whole vectors, and at least one; a vector holds twice as many floats
+    const size_t width = precision == Precision::Double ? 8 : 16;
+    return std::max<size_t>(bodies / width * width, width);
+}
+
+/*
+ * Add the forces of sources j in [j_begin, j_end) on targets i in
+ * [i_begin, i_end) to f[i]. If SYMMETRIC, targets and sources are the same
+ * bodies, only pairs with j > i are evaluated, and each force is also
+ * subtracted from f[j]. Pairs are evaluated in Real, forces added up in Acc.
+ */
+template <bool SYMMETRIC, typename Real, typename Acc>
+void accumulate_tile(const Bodies& targets, const Bodies& sources, Forces& f,
+                     const size_t i_begin, const size_t i_end, const size_t j_begin,
+                     const size_t j_end) {
+    const Real *x, *y, *m, *x_targets, *y_targets, *m_targets;
+    get_arrays(sources, x, y, m);
+    get_arrays(targets, x_targets, y_targets, m_targets);
+    Acc *fx, *fy;
+    get_arrays(f, fx, fy);
+
+    for (size_t i = i_begin; i < i_end; ++i) {
+        const Real x_i = x_targets[i], y_i = y_targets[i];
+        const Real gm_i = static_cast<Real>(GRAVITY_CONST) * m_targets[i];
+        Acc f_x = 0, f_y = 0;
+        size_t j = SYMMETRIC ? std::max(j_begin, i + 1) : j_begin;
+#ifdef FORCE_KERNEL_SIMD
+        using vreal = typename Simd<Real>::type;
+        constexpr size_t width = Simd<Real>::width;
+        const vreal v_x_i = vset(x_i), v_y_i = vset(y_i), v_gm_i = vset(gm_i);
+        RowSum<Real, Acc> sum_x, sum_y;
+        for (; j + width <= j_end; j += width) {
+            const vreal dx = vsub(vload(x + j), v_x_i);
+            const vreal dy = vsub(vload(y + j), v_y_i);
+            const vreal r_sqr = vfmadd(dx, dx, vmul(dy, dy));
+            const vreal s = vforce_scale<Real>(v_gm_i, vload(m + j), r_sqr);
+            sum_x.add(s, dx);
+            sum_y.add(s, dy);
+            if (SYMMETRIC) {
+                vsubtract(fx + j, s, dx);
+                vsubtract(fy + j, s, dy);
+            }
+        }
+        f_x = sum_x.total();
+        f_y = sum_y.total();
+#endif
+        for (; j < j_end; ++j) {
+            // body i itself is at distance 0 and adds nothing
+            const Real dx = x[j] - x_i, dy = y[j] - y_i;
+            const Real s = force_scale(gm_i, m[j], dx * dx + dy * dy);
+            f_x += s * dx;
+            f_y += s * dy;
+            if (SYMMETRIC) {
+                fx[j] -= s * dx;
+                fy[j] -= s * dy;
+            }
+        }
+        fx[i] += f_x;
+        fy[i] += f_y;
+    }
+}
+
+template <bool SYMMETRIC, typename Real, typename Acc>
+void accumulate_blocked(const Bodies& targets, const Bodies& sources, Forces& f,
+                        const size_t begin, const size_t end, const size_t j_begin,
+                        const size_t j_end) {
+    const Tiling& tiling = force_tiling();
+    for (size_t i_begin = begin; i_begin < end; i_begin += tiling.block) {
+        const size_t i_end = std::min(i_begin + tiling.block, end);
+        // a symmetric block has no pairs left of its first body
+        const size_t first = SYMMETRIC ? std::max(j_begin, i_begin + 1) : j_begin;
+        for (size_t tile = first; tile < j_end; tile += tiling.tile) {
+            const size_t tile_end = std::min(tile + tiling.tile, j_end);
+            accumulate_tile<SYMMETRIC, Real, Acc>(targets, sources, f, i_begin, i_end, tile,
+                                                  tile_end);
+        }
+    }
+}
+
+template <bool SYMMETRIC>
+void accumulate(const Bodies& targets, const Bodies& sources, Forces& f, const size_t begin,
+                const size_t end, const size_t j_begin, const size_t j_end) {
+    if (precision == Precision::Float) {
+        accumulate_blocked<SYMMETRIC, float, float>(targets, sources, f, begin, end, j_begin,
+                                                    j_end);
+    }
+    else if (precision == Precision::Mixed) {
+        accumulate_blocked<SYMMETRIC, float, double>(targets, sources, f, begin, end, j_begin,
+                                                     j_end);
+    }
+    else {
+        accumulate_blocked<SYMMETRIC, double, double>(targets, sources, f, begin, end, j_begin,
+                                                      j_end);
+    }
+}
+
+}  // namespace
+
+const char* force_kernel_isa() {
+    return ISA;
+}
+
+const Tiling& force_tiling() {
+    // half of each cache, the rest is left to the bodies i and their forces
+    static const Tiling tiling{
+        tile_size > 0 ? static_cast<size_t>(tile_size)
+                      : round_to_width(cache_size(1, 32 * 1024) / 2 / body_bytes()),
+        block_size > 0 ? static_cast<size_t>(block_size)
+                       : round_to_width(cache_size(2, 256 * 1024) / 2 / body_bytes()),
+    };
+    return tiling;
+}
+
+void accumulate_forces(const Bodies& bodies, Forces& f, const size_t begin, const size_t end) {
+    accumulate<true>(bodies, bodies, f, begin, end, 0, bodies.size());
+}
+
+void accumulate_row_forces(const Bodies& bodies, Forces& f, const size_t begin,
+                           const size_t end) {
+    accumulate<false>(bodies, bodies, f, begin, end, 0, bodies.size());
+}
+
+void accumulate_row_forces(const Bodies& bodies, Forces& f, const size_t begin,
+                           const size_t end, const size_t j_begin, const size_t j_end) {
+    accumulate<false>(bodies, bodies, f, begin, end, j_begin, j_end);
+}
+
+void accumulate_block_forces(const Bodies& targets, const Bodies& sources, Forces& f) {
+    accumulate<false>(targets, sources, f, 0, targets.size(), 0, sources.size());
+}
@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "bodies.h"
+#include "checkpoint.h"
+#include "common.h"
+
+bool checkpoint_due(const int iteration) {
+    return checkpoint_interval > 0 && iteration % checkpoint_interval == 0;
+}
+
+CheckpointHeader checkpoint_header(const int iteration) {
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.format = CHECKPOINT_FORMAT;
+    header.n_body = n_body;
+    header.iteration = iteration;
+    header.seed = seed;
+    header.force_engine = static_cast<int32_t>(force_engine);
+    header.collision_engine = static_cast<int32_t>(collision_engine);
+    header.theta = theta;
+    // the tiles actually used, a machine with other caches would sum in another order
+    header.tile = force_tiling().tile;
+    header.block = force_tiling().block;
+    header.precision = static_cast<int32_t>(precision);
+    return header;
+}
+
+bool check_checkpoint_header(const CheckpointHeader& header, const std::string& path) {
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.format != CHECKPOINT_FORMAT) {
+        std::cerr << "Not a checkpoint of this version: " << path << '\n';
+        return false;
+    }
+    if (header.n_body != static_cast<uint32_t>(n_body)) {
+        std::cerr << "The checkpoint holds " << header.n_body << " bodies, not " << n_body
+                  << '\n';
+        return false;
+    }
+    return true;
+}
+
+void apply_checkpoint_header(const CheckpointHeader& header) {
+    seed = header.seed;
+    force_engine = static_cast<ForceEngine>(header.force_engine);
+    collision_engine = static_cast<CollisionEngine>(header.collision_engine);
+    theta = header.theta;
+    tile_size = static_cast<int>(header.tile);
+    block_size = static_cast<int>(header.block);
+    precision = static_cast<Precision>(header.precision);
+}
+
+namespace {
+
+CheckpointHeader read_checkpoint(const std::string& path, std::vector<double>& m,
+                                 std::vector<Point>& pos, std::vector<Velocity>& v) {
+    std::ifstream file(path, std::ios::binary);
+    CheckpointHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file) {
+        std::cerr << "Cannot read the checkpoint " << path << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+    if (!check_checkpoint_header(header, path)) std::exit(EXIT_FAILURE);
+
+    m.resize(n_body);
+    pos.resize(n_body, Point{});
+    v.resize(n_body, Velocity{});
+    file.read(reinterpret_cast<char*>(m.data()), n_body * sizeof(double));
+    file.read(reinterpret_cast<char*>(pos.data()), n_body * sizeof(Point));
+    file.read(reinterpret_cast<char*>(v.data()), n_body * sizeof(Velocity));
+    if (!file) {
+        std::cerr << "The checkpoint " << path << " is cut short\n";
+        std::exit(EXIT_FAILURE);
+    }
+    return header;
+}
+
+}  // namespace
+
+int load_checkpoint(const std::string& path, std::vector<double>& m, std::vector<Point>& pos,
+                    std::vector<Velocity>& v) {
+    const CheckpointHeader header = read_checkpoint(path, m, pos, v);
+    apply_checkpoint_header(header);
+    return static_cast<int>(header.iteration);
+}
+
+void load_bodies(const std::string& path, std::vector<double>& m, std::vector<Point>& pos,
+                 std::vector<Velocity>& v) {
+    read_checkpoint(path, m, pos, v);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    finish();
+}
+
+void CheckpointWriter::save(const int iteration, const std::vector<double>& m,
+                            const std::vector<Point>& pos, const std::vector<Velocity>& v) {
+    // the copies are only reused once the previous checkpoint is on disk
+    finish();
+    header = checkpoint_header(iteration);
+    this->m.assign(m.begin(), m.begin() + n_body);
+    this->pos.assign(pos.begin(), pos.begin() + n_body);
+    this->v.assign(v.begin(), v.begin() + n_body);
+    writer = std::thread(&CheckpointWriter::write, this);
+}
+
+void CheckpointWriter::finish() {
+    if (writer.joinable()) writer.join();
+}
+
+void CheckpointWriter::write() const {
+    const std::string tmp_path = checkpoint_path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(m.data()), m.size() * sizeof(double));
+    file.write(reinterpret_cast<const char*>(pos.data()), pos.size() * sizeof(Point));
+    file.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(Velocity));
+    file.close();
+    if (!file || std::rename(tmp_path.c_str(), checkpoint_path.c_str()) != 0) {
+        std::cerr << "Cannot write the checkpoint " << checkpoint_path << '\n';
+    }
+}
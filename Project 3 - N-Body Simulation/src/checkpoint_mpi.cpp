@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "checkpoint_mpi.h"
+#include "common.h"
+
+MpiCheckpointWriter::~MpiCheckpointWriter() {
+    finish();
+}
+
+void MpiCheckpointWriter::save(const int iteration, const double* m, const Point* pos,
+                               const Velocity* v, const int first, const int count) {
+    // the copies are only reused once the previous checkpoint is on disk
+    finish();
+    header = checkpoint_header(iteration);
+    this->m.assign(m, m + count);
+    this->pos.assign(pos, pos + count);
+    this->v.assign(v, v + count);
+
+    const std::string tmp_path = checkpoint_path + ".tmp";
+    if (MPI_File_open(MPI_COMM_WORLD, tmp_path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        std::cerr << "Cannot write the checkpoint " << checkpoint_path << '\n';
+        file = MPI_FILE_NULL;
+        return;
+    }
+    MPI_File_set_size(file, 0);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) {
+        MPI_File_iwrite_at(file, 0, &header, sizeof(header), MPI_BYTE, &requests[3]);
+    }
+    const uint64_t n = n_body;
+    MPI_File_iwrite_at_all(file, checkpoint_m_offset() + first * sizeof(double),
+                           this->m.data(), count, MPI_DOUBLE, &requests[0]);
+    MPI_File_iwrite_at_all(file, checkpoint_pos_offset(n) + first * sizeof(Point),
+                           this->pos.data(), 2 * count, MPI_DOUBLE, &requests[1]);
+    MPI_File_iwrite_at_all(file, checkpoint_v_offset(n) + first * sizeof(Velocity),
+                           this->v.data(), 2 * count, MPI_DOUBLE, &requests[2]);
+}
+
+void MpiCheckpointWriter::finish() {
+    if (file == MPI_FILE_NULL) return;
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+    // closing is collective, every rank has written its part once it returns
+    MPI_File_close(&file);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    const std::string tmp_path = checkpoint_path + ".tmp";
+    if (rank == 0 && std::rename(tmp_path.c_str(), checkpoint_path.c_str()) != 0) {
+        std::cerr << "Cannot write the checkpoint " << checkpoint_path << '\n';
+    }
+    // no rank may open the next checkpoint before it is renamed
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+namespace {
+
+CheckpointHeader read_checkpoint(const std::string& path, double* m, Point* pos, Velocity* v,
+                                 const int first, const int count) {
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) !=
+        MPI_SUCCESS) {
+        std::cerr << "Cannot read the checkpoint " << path << '\n';
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    CheckpointHeader header{};
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    if (!check_checkpoint_header(header, path)) MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    const uint64_t n = n_body;
+    MPI_Offset size;
+    MPI_File_get_size(file, &size);
+    if (static_cast<uint64_t>(size) < checkpoint_v_offset(n) + n * sizeof(Velocity)) {
+        std::cerr << "The checkpoint " << path << " is cut short\n";
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    MPI_File_read_at_all(file, checkpoint_m_offset() + first * sizeof(double), m, count,
+                         MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_read_at_all(file, checkpoint_pos_offset(n) + first * sizeof(Point), pos,
+                         2 * count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_read_at_all(file, checkpoint_v_offset(n) + first * sizeof(Velocity), v, 2 * count,
+                         MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    return header;
+}
+
+}  // namespace
+
+int load_checkpoint(const std::string& path, double* m, Point* pos, Velocity* v,
+                    const int first, const int count) {
+    const CheckpointHeader header = read_checkpoint(path, m, pos, v, first, count);
+    apply_checkpoint_header(header);
+    return static_cast<int>(header.iteration);
+}
+
+void load_bodies(const std::string& path, double* m, Point* pos, Velocity* v, const int first,
+                 const int count) {
+    read_checkpoint(path, m, pos, v, first, count);
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "collision_grid.h"
+
+void CollisionGrid::resize(const size_t n, const int n_chunks) {
+    size_t n_buckets = 1;
+    while (n_buckets < 2 * n) n_buckets *= 2;
+    mask = n_buckets - 1;
+    chunks = n_chunks;
+
+    cell_x.resize(n);
+    cell_y.resize(n);
+    body_bucket.resize(n);
+    sorted.resize(n);
+    // value-initialized, i.e. all counts 0
+    slots.reset(new std::atomic<int>[n_buckets]());
+    chunk_bodies.resize(n_chunks);
+    bucket_begin.resize(n_buckets + 1);
+}
+
+void CollisionGrid::count(const std::vector<Point>& pos, const int, const size_t begin,
+                          const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        cell_x[i] = static_cast<int>(std::floor(pos[i].x / GRID_CELL));
+        cell_y[i] = static_cast<int>(std::floor(pos[i].y / GRID_CELL));
+        body_bucket[i] = static_cast<int>(bucket(cell_x[i], cell_y[i]));
+        slots[body_bucket[i]].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CollisionGrid::sum(const int chunk) {
+    int total = 0;
+    for (size_t b = chunk_begin(chunk); b < chunk_end(chunk); ++b) {
+        total += slots[b].load(std::memory_order_relaxed);
+    }
+    chunk_bodies[chunk] = total;
+}
+
+void CollisionGrid::prefix(const int chunk) {
+    // the chunks before this one are summed again by every chunk, there are only a few
+    int total = 0;
+    for (int c = 0; c < chunk; ++c) {
+        total += chunk_bodies[c];
+    }
+    for (size_t b = chunk_begin(chunk); b < chunk_end(chunk); ++b) {
+        bucket_begin[b] = total;
+        total += slots[b].load(std::memory_order_relaxed);
+        slots[b].store(bucket_begin[b], std::memory_order_relaxed);
+    }
+    if (chunk == chunks - 1) bucket_begin[mask + 1] = total;
+}
+
+void CollisionGrid::scatter(int, const size_t begin, const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        sorted[slots[body_bucket[i]].fetch_add(1, std::memory_order_relaxed)] =
+            static_cast<int>(i);
+    }
+}
+
+void CollisionGrid::sort(const int chunk) {
+    // buckets hold about half a body each, insertion sort is enough
+    for (size_t b = chunk_begin(chunk); b < chunk_end(chunk); ++b) {
+        for (int k = bucket_begin[b] + 1; k < bucket_begin[b + 1]; ++k) {
+            const int body = sorted[k];
+            int slot = k;
+            for (; slot > bucket_begin[b] && sorted[slot - 1] > body; --slot) {
+                sorted[slot] = sorted[slot - 1];
+            }
+            sorted[slot] = body;
+        }
+        slots[b].store(0, std::memory_order_relaxed);
+    }
+}
+
+void CollisionGrid::build(const std::vector<Point>& pos, const size_t n) {
+    if (chunks != 1 || sorted.size() != n) resize(n, 1);
+    count(pos, 0, 0, n);
+    sum(0);
+    prefix(0);
+    scatter(0, 0, n);
+    sort(0);
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <vector>
+
+#include "collisions.h"
+
+void Collisions::resize(const int n_chunks) {
+    contacts.resize(n_chunks);
+}
+
+void Collisions::detect(const std::vector<Point>& pos, const size_t n, const int chunk,
+                        const size_t begin, const size_t end) {
+    std::vector<Contact>& list = contacts[chunk];
+    list.clear();
+    for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            if (i == j) continue;
+            if (pos[i].sqr_dist(pos[j]) < COLLISION_DIST2) {
+                list.push_back(Contact{static_cast<int>(i), static_cast<int>(j)});
+            }
+        }
+    }
+}
+
+void Collisions::detect(const CollisionGrid& grid, const std::vector<Point>& pos, const int chunk,
+                        const size_t begin, const size_t end) {
+    std::vector<Contact>& list = contacts[chunk];
+    list.clear();
+    for (size_t i = begin; i < end; ++i) {
+        const size_t first = list.size();
+        grid.for_each_neighbor(i, [&](const int j) {
+            if (pos[i].sqr_dist(pos[j]) < COLLISION_DIST2) {
+                list.push_back(Contact{static_cast<int>(i), j});
+            }
+        });
+        // the grid visits cells in hash order, put the partners in index order
+        std::sort(list.begin() + first, list.end(),
+                  [](const Contact& a, const Contact& b) { return a.partner < b.partner; });
+    }
+}
+
+void Collisions::resolve(const std::vector<double>& m, std::vector<Point>& pos,
+                         std::vector<Velocity>& v, const int chunk) const {
+    for (const Contact& contact : contacts[chunk]) {
+        const int i = contact.body;
+        bounce_off(m[i], m[contact.partner], pos[i], v[i]);
+    }
+}
+
+void Collisions::bounced(const int chunk, std::vector<int>& bodies) const {
+    // the contacts are sorted by body
+    for (const Contact& contact : contacts[chunk]) {
+        if (bodies.empty() || bodies.back() != contact.body) bodies.push_back(contact.body);
+    }
+}
@@ -15,6 +15,7 @@
 #include <GL/glut.h>
 #endif
 
+#include <cstring>
 #include <iostream>
 
 #include "common.h"
@@ -26,23 +27,125 @@ std::vector<double> m;
 std::vector<Point> pos;
 std::vector<Velocity> v;
 
+ForceEngine force_engine = ForceEngine::Direct;
+double theta = 0.5;
+CollisionEngine collision_engine = CollisionEngine::Direct;
+int tile_size = 0;
+int block_size = 0;
+Precision precision = Precision::Double;
+bool validate = false;
+int checkpoint_interval = 0;
+std::string checkpoint_path = "checkpoint.bin";
+std::string restart_path;
+uint64_t seed = 0;
+std::string input_path;
+
+std::vector<char*> parse_args(const int argc, char** argv) {
+    /*
+     * options:
+     *     --force=<direct|bh>  sum all pairs, or approximate with a Barnes-Hut tree
+     *     --theta=<angle>      opening angle of the tree, 0 gives the direct sum
+     *     --collision=<direct|grid>  check all pairs, or neighbouring cells of a spatial hash
+     *     --tile=<bodies>      bodies j the direct sum keeps in L1, 0 for the cache size
+     *     --block=<bodies>     bodies i that reuse a tile, 0 for the L2 cache size
+     *     --precision=<double|float|mixed>  arithmetic of the direct sum, mixed adds float
+     *                          forces in double
+     *     --validate           report the drift from a double precision run (sequential)
+     *     --checkpoint=<iterations>  save the state every that many iterations, 0 for never
+     *     --checkpoint-file=<path>   where to save it, checkpoint.bin by default
+     *     --restart=<path>     continue the run saved in a checkpoint
+     *     --seed=<number>      seed of the initial data, a random one by default
+     *     --input=<path>       read the initial data from a checkpoint file instead
+     */
+    std::vector<char*> positional;
+    bool seeded = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            positional.push_back(argv[i]);
+            continue;
+        }
+
+        const char* eq = strchr(argv[i], '=');
+        const std::string key =
+            eq ? std::string(argv[i] + 2, eq - argv[i] - 2) : std::string(argv[i] + 2);
+        const std::string value = eq ? eq + 1 : "";
+
+        if (key == "force") {
+            force_engine = value == "bh" ? ForceEngine::BarnesHut : ForceEngine::Direct;
+        }
+        else if (key == "theta") {
+            theta = std::stod(value);
+        }
+        else if (key == "collision") {
+            collision_engine = value == "grid" ? CollisionEngine::Grid : CollisionEngine::Direct;
+        }
+        else if (key == "tile") {
+            tile_size = std::stoi(value);
+        }
+        else if (key == "block") {
+            block_size = std::stoi(value);
+        }
+        else if (key == "precision") {
+            precision = value == "float"   ? Precision::Float
+                        : value == "mixed" ? Precision::Mixed
+                                           : Precision::Double;
+        }
+        else if (key == "validate") {
+            validate = true;
+        }
+        else if (key == "checkpoint") {
+            checkpoint_interval = std::stoi(value);
+        }
+        else if (key == "checkpoint-file") {
+            checkpoint_path = value;
+        }
+        else if (key == "restart") {
+            restart_path = value;
+        }
+        else if (key == "seed") {
+            seed = std::stoull(value);
+            seeded = true;
+        }
+        else if (key == "input") {
+            input_path = value;
+        }
+        else {
+            std::cerr << "Unknown option: " << argv[i] << '\n';
+        }
+    }
+    if (!seeded) seed = std::random_device()();
+    return positional;
+}
+
+namespace {
+
+// number k of body i, the SplitMix64 sequence of the seed evaluated at a counter, so that
+// it needs no state and any body can be generated on its own
+uint64_t body_random(const int i, const int k) {
+    constexpr uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15;
+    uint64_t z = seed + (3 * static_cast<uint64_t>(i) + k + 1) * GOLDEN_GAMMA;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+}  // namespace
+
+void generate_bodies(double* m, Point* pos, Velocity* v, const int begin, const int end) {
+    for (int i = begin; i < end; i++) {
+        m[i - begin] = 1 + body_random(i, 0) % MAX_MASS;
+        pos[i - begin].x = 2000.0 + body_random(i, 1) % (BOUND_X / 4);
+        pos[i - begin].y = 2000.0 + body_random(i, 2) % (BOUND_Y / 4);
+        v[i - begin] = Velocity{};
+    }
+}
+
 void generate_data(std::vector<double>& m, std::vector<Point>& pos, std::vector<Velocity>& v,
                    const int n) {
     m.resize(n_body, 0);
     pos.resize(n_body, Point{});
     v.resize(n_body, Velocity{});
-
-    // initialize a random distribution
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_int_distribution<std::mt19937::result_type> uniform(0, RAND_MAX);
-    std::uniform_int_distribution<std::mt19937::result_type> u_mass(1, MAX_MASS);
-
-    for (int i = 0; i < n; i++) {
-        m[i] = u_mass(rng);
-        pos[i].x = 2000.0 + uniform(rng) % (BOUND_X / 4);
-        pos[i].y = 2000.0 + uniform(rng) % (BOUND_Y / 4);
-    }
+    generate_bodies(m.data(), pos.data(), v.data(), 0, n);
 }
 
 void print_information(const std::string prog_name, const int size, const int num_cores) {
@@ -89,7 +192,7 @@ void glut_update() {
     glut_update(pos.data(), pos.size());
 }
 
-inline void glut_update(const Point* data, const size_t n) {
+void glut_update(const Point* data, const size_t n) {
     glClear(GL_COLOR_BUFFER_BIT);
     glColor3f(1.0f, 0.0f, 0.0f);
     glPointSize(2.0f);
@@ -35,6 +35,8 @@ __device__ Force get_force_cuda(const double m1, const double m2, const Point& p
                                 const Point& pos2) {
     const double dx = pos2.x - pos1.x, dy = pos2.y - pos1.y;
     const double r_sqr = dx * dx + dy * dy;
+    // bodies at the same position pull in no direction
+    if (r_sqr == 0) return Force{0, 0};
     const double r = sqrt(r_sqr);
     const double f = GRAVITY_CONST * m1 * m2 / (r_sqr + FLOAT_OP_ERROR);
     return Force{f * dx / r, f * dy / r};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+
+#include "physics.h"
+
+/*
+ * Barnes-Hut quadtree.
+ * A cell whose size s seen from a body at distance d is small enough,
+ * s / d < theta, acts on the body as a single body at its center of mass;
+ * otherwise its children are visited. Leaves hold a few bodies that are
+ * summed directly, so theta = 0 gives the direct sum (up to the summation
+ * order).
+ *
+ * The tree is rebuilt every step in three parts, so that parallel targets
+ * can build the subtrees of the top cells concurrently:
+ *     tree.build_top(m, pos, n);
+ *     for each cell c < tree.n_cells(): tree.build_cell(c);   // in parallel
+ *     tree.build_finish();
+ */
+
+// bodies a leaf may hold before it is split
+constexpr int LEAF_SIZE = 8;
+// levels built serially by build_top(), giving 4^TOP_DEPTH cells
+constexpr int TOP_DEPTH = 3;
+// deeper cells are not split any more, e.g. for bodies at the same position
+constexpr int MAX_DEPTH = 48;
+
+class BarnesHut {
+public:
+    // partition the bodies into the top cells
+    void build_top(const std::vector<double>& m, const std::vector<Point>& pos, size_t n);
+
+    // number of top cells, valid after build_top()
+    size_t n_cells() const { return cells.size(); }
+
+    // build the subtree of a top cell, cells may be built concurrently
+    void build_cell(size_t cell);
+
+    // link the subtrees into the tree
+    void build_finish();
+
+    // all three steps on the calling thread
+    void build(const std::vector<double>& m, const std::vector<Point>& pos, size_t n);
+
+    // total gravity force on body i
+    Force get_force(size_t i, double theta) const;
+
+private:
+    struct Node {
+        Point center;         // center of the square cell
+        double half;          // half of its side length
+        Point mass_center;    // center of mass of its bodies
+        double mass;
+        int first_child;      // index of the first of 4 children, -1 for a leaf
+        int begin, end;       // bodies order[begin, end)
+    };
+
+    struct Cell {
+        int node;             // the top node the subtree hangs from
+        std::vector<Node> nodes;
+    };
+
+    // give a node 4 children, and their children while they are crowded if recurse
+    void split(std::vector<Node>& tree, size_t node, int depth, bool recurse);
+    // set the mass and center of mass of a node from its bodies or children
+    void summarize(std::vector<Node>& tree, size_t node);
+
+    const std::vector<double>* mass = nullptr;
+    const std::vector<Point>* position = nullptr;
+    std::vector<int> order;   // body indices, the bodies of a node are contiguous
+    std::vector<int> slot;    // position of each body in order
+    std::vector<Node> nodes;  // node 0 is the root
+    size_t n_top = 0;         // nodes built by build_top()
+    std::vector<Cell> cells;
+};
+
+// v += a * dt with the force of the tree
+void update_velocity(const BarnesHut& tree, const std::vector<double>& m,
+                     std::vector<Velocity>& v, size_t i, double theta);
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "physics.h"
+
+/*
+ * Structure-of-arrays copies of the bodies for the force kernels.
+ * The simulation keeps its Point / Velocity arrays; every step the positions
+ * are packed into separate, 64-byte aligned x and y arrays, which is O(n)
+ * next to the O(n^2) force evaluation, so that the kernels can load 4
+ * (AVX2) or 8 (AVX-512) bodies j per instruction. Which instruction set is
+ * used is decided at compile time, see NATIVE_ARCH in CMakeLists.txt;
+ * without one the kernels fall back to scalar code.
+ *
+ * The kernels are cache blocked: the bodies j are cut into tiles that fit
+ * L1, and every tile is used by a whole block of bodies i, sized to L2,
+ * before the next tile is loaded, instead of streaming all n bodies j from
+ * memory once per body i.
+ *
+ * The kernels are templated on their arithmetic, chosen by --precision:
+ * double, float, or mixed, which evaluates the pairs in float but adds
+ * the forces up in double. In float and mixed precision the bodies also
+ * keep float copies of x, y and m, twice as many bodies fit a vector and
+ * the caches. Positions and velocities stay double, only the forces lose
+ * precision.
+ */
+
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    static constexpr std::align_val_t ALIGNMENT{64};
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(const size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), ALIGNMENT));
+    }
+    void deallocate(T* p, size_t) { ::operator delete(p, ALIGNMENT); }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+struct Bodies {
+    aligned_vector<double> x, y, m;
+    aligned_vector<float> xf, yf, mf;  // empty in double precision
+
+    // masses do not change, load them once
+    void load_masses(const std::vector<double>& masses, size_t n);
+    // positions of bodies [begin, end), after they moved
+    void load_positions(const std::vector<Point>& pos, size_t begin, size_t end);
+    // room for n bodies, e.g. to receive them
+    void resize(size_t n);
+    // the float copies of bodies [begin, end) from x, y and m, e.g. after receiving them
+    void load_floats(size_t begin, size_t end);
+    size_t size() const { return m.size(); }
+};
+
+struct Forces {
+    aligned_vector<double> x, y;
+    aligned_vector<float> xf, yf;  // used instead of x and y in float precision
+
+    // n zero forces
+    void clear(size_t n);
+    Force operator[](const size_t i) const {
+        return xf.empty() ? Force{x[i], y[i]} : Force{xf[i], yf[i]};
+    }
+};
+
+// name of the instruction set the kernels were compiled for
+const char* force_kernel_isa();
+
+struct Tiling {
+    size_t tile;   // bodies j kept in L1
+    size_t block;  // bodies i that use a tile before the next one is loaded
+};
+
+// --tile and --block, or sizes derived from the caches of this machine
+const Tiling& force_tiling();
+
+// Newton's third law: evaluate every pair (i, j), i in [begin, end) and j > i, once,
+// add the force to f[i] and subtract it from f[j]
+void accumulate_forces(const Bodies& bodies, Forces& f, size_t begin, size_t end);
+
+// add the forces of all other bodies to f[i] for i in [begin, end)
+void accumulate_row_forces(const Bodies& bodies, Forces& f, size_t begin, size_t end);
+
+// add the forces of bodies j in [j_begin, j_end) to f[i] for i in [begin, end),
+// e.g. of the bodies whose positions have arrived
+void accumulate_row_forces(const Bodies& bodies, Forces& f, size_t begin, size_t end,
+                           size_t j_begin, size_t j_end);
+
+// add the forces of all bodies of sources to f[i] for every body i of targets,
+// e.g. of a block of bodies held by another process
+void accumulate_block_forces(const Bodies& targets, const Bodies& sources, Forces& f);
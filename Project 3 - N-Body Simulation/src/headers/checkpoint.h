@@ -1,15 +1,97 @@
-// #include <time.h>
-
-// class Logger {
-//     public:
-//         int n_body;
-//         int x_bound;
-//         int y_bound;
-//         int current_iteration;
-//         char* version;
-//         char* start_time;
-//         Logger();
-//         void save_frame(double* x, double* y);
-//         void update_metadata();
-//         ~Logger();
-// };
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "physics.h"
+
+/*
+ * Checkpoints of a run, to continue it after it was stopped.
+ * A checkpoint file holds a CheckpointHeader, then the masses, positions
+ * and velocities of all bodies, each array in the order of the bodies:
+ *     header | m[0, n) | pos[0, n) | v[0, n)
+ * so that a process writes or reads its own bodies of every array at a
+ * fixed offset, see checkpoint_mpi.h. All values are stored as they are in
+ * memory, a restarted run continues with the same bits. Any file in this
+ * format can also give the initial bodies of a new run, see --input.
+ *
+ * A checkpoint is written to <path>.tmp and renamed to <path> once it is
+ * complete, so the previous checkpoint survives a crash in the middle of
+ * a write.
+ */
+
+constexpr char CHECKPOINT_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+constexpr uint32_t CHECKPOINT_FORMAT = 1;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t n_body;
+    uint64_t iteration;         // iterations done
+    uint64_t seed;              // of the initial bodies, see generate_bodies()
+    int32_t force_engine;
+    int32_t collision_engine;
+    double theta;
+    uint64_t tile;              // tiling of the direct sum, it sets the order of the sums
+    uint64_t block;
+    int32_t precision;          // of the direct sum, 0 (double) in older checkpoints
+    uint8_t reserved[12];
+};
+static_assert(sizeof(CheckpointHeader) == 80, "CheckpointHeader is written as is");
+
+// offsets of the arrays in a checkpoint of n bodies
+inline uint64_t checkpoint_m_offset() { return sizeof(CheckpointHeader); }
+inline uint64_t checkpoint_pos_offset(const uint64_t n) {
+    return checkpoint_m_offset() + n * sizeof(double);
+}
+inline uint64_t checkpoint_v_offset(const uint64_t n) {
+    return checkpoint_pos_offset(n) + n * sizeof(Point);
+}
+
+// whether a checkpoint is due after this many iterations, see --checkpoint
+bool checkpoint_due(int iteration);
+
+// the header of a checkpoint of the current run after this many iterations
+CheckpointHeader checkpoint_header(int iteration);
+
+// whether a header read from path is a checkpoint of n_body bodies, the error is printed
+bool check_checkpoint_header(const CheckpointHeader& header, const std::string& path);
+
+// continue with the options of the run that saved a checkpoint
+void apply_checkpoint_header(const CheckpointHeader& header);
+
+// read a whole checkpoint into m, pos and v, return the iterations done; exits on errors
+int load_checkpoint(const std::string& path, std::vector<double>& m, std::vector<Point>& pos,
+                    std::vector<Velocity>& v);
+
+// read the bodies of a checkpoint as the initial data of a new run, see --input; its
+// iterations and options are not used; exits on errors
+void load_bodies(const std::string& path, std::vector<double>& m, std::vector<Point>& pos,
+                 std::vector<Velocity>& v);
+
+class CheckpointWriter {
+public:
+    CheckpointWriter() = default;
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+    ~CheckpointWriter();
+
+    // copy the state after this many iterations and write it in the background, once the
+    // previous checkpoint is written
+    void save(int iteration, const std::vector<double>& m, const std::vector<Point>& pos,
+              const std::vector<Velocity>& v);
+
+    // wait for the checkpoint being written
+    void finish();
+
+private:
+    void write() const;
+
+    CheckpointHeader header{};
+    std::vector<double> m;
+    std::vector<Point> pos;
+    std::vector<Velocity> v;
+    std::thread writer;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "checkpoint.h"
+
+/*
+ * Checkpoints of the MPI targets, in the format of checkpoint.h.
+ * Every rank writes its own bodies with collective MPI-IO, so the state is
+ * never gathered on one rank, and reads back the bodies it needs.
+ * Writing is nonblocking: save() copies the bodies and starts the writes,
+ * which complete while the simulation goes on; the next save() or
+ * finish() waits for them.
+ */
+
+class MpiCheckpointWriter {
+public:
+    MpiCheckpointWriter() = default;
+    MpiCheckpointWriter(const MpiCheckpointWriter&) = delete;
+    MpiCheckpointWriter& operator=(const MpiCheckpointWriter&) = delete;
+    ~MpiCheckpointWriter();
+
+    // collective: the state after this many iterations, of bodies [first, first + count)
+    // that this rank owns
+    void save(int iteration, const double* m, const Point* pos, const Velocity* v, int first,
+              int count);
+
+    // collective: wait for the checkpoint being written
+    void finish();
+
+private:
+    CheckpointHeader header{};
+    std::vector<double> m;
+    std::vector<Point> pos;
+    std::vector<Velocity> v;
+    MPI_File file = MPI_FILE_NULL;
+    MPI_Request requests[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL,
+                               MPI_REQUEST_NULL};
+};
+
+// collective: read bodies [first, first + count) of the checkpoint at path into m, pos and v,
+// return the iterations done; aborts on errors
+int load_checkpoint(const std::string& path, double* m, Point* pos, Velocity* v, int first,
+                    int count);
+
+// collective: the same bodies as the initial data of a new run, see --input
+void load_bodies(const std::string& path, double* m, Point* pos, Velocity* v, int first,
+                 int count);
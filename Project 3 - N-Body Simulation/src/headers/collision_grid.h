@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "physics.h"
+
+/*
+ * Spatial hash for body-body collisions.
+ * Space is cut into square cells of side GRID_CELL, the collision distance,
+ * so a body can only collide with bodies of its own and the 8 surrounding
+ * cells. A uniform grid over [0, BOUND_X] x [0, BOUND_Y] would have far more
+ * cells than bodies, so cells are hashed into about 2n buckets instead.
+ *
+ * The bodies are sorted by bucket with a counting sort every step, in five
+ * phases, each of which must be done before the next one starts. Chunks
+ * split the bodies, and the buckets, into disjoint ranges that may be
+ * processed concurrently:
+ *     grid.resize(n, n_chunks);                        // once
+ *     grid.count(pos, chunk, begin, end);              // for every chunk of bodies
+ *     grid.sum(chunk);                                 // for every chunk of buckets
+ *     grid.prefix(chunk);                              // for every chunk of buckets
+ *     grid.scatter(chunk, begin, end);                 // for every chunk of bodies
+ *     grid.sort(chunk);                                // for every chunk of buckets
+ * All chunks share one array of counters, one per bucket, which count()
+ * and scatter() update atomically. Bodies land in a bucket in any order,
+ * sort() puts every bucket back in the order of the bodies' indices, so the
+ * result does not depend on the number of chunks or on their timing.
+ */
+
+// side length of a cell, the collision distance sqrt(COLLISION_DIST2)
+constexpr double GRID_CELL = 0.2;
+static_assert(GRID_CELL * GRID_CELL >= COLLISION_DIST2, "cells must cover the collision distance");
+
+class CollisionGrid {
+public:
+    // set the number of bodies and chunks
+    void resize(size_t n, int n_chunks);
+
+    // find the cells of bodies [begin, end) and count them per bucket
+    void count(const std::vector<Point>& pos, int chunk, size_t begin, size_t end);
+
+    // the number of bodies in a chunk of buckets
+    void sum(int chunk);
+
+    // where every bucket of a chunk of buckets starts
+    void prefix(int chunk);
+
+    // place bodies [begin, end) in their buckets
+    void scatter(int chunk, size_t begin, size_t end);
+
+    // order the bodies of every bucket of a chunk of buckets by index, and clear the counts
+    // for the next step
+    void sort(int chunk);
+
+    // all steps on the calling thread
+    void build(const std::vector<Point>& pos, size_t n);
+
+    // call f(j) for every other body j in the 3x3 cells around body i
+    template <typename F>
+    void for_each_neighbor(size_t i, F f) const {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const int cx = cell_x[i] + dx, cy = cell_y[i] + dy;
+                const size_t b = bucket(cx, cy);
+                for (int k = bucket_begin[b]; k < bucket_begin[b + 1]; ++k) {
+                    const int j = sorted[k];
+                    // buckets are shared by cells, skip bodies of other cells
+                    if (cell_x[j] != cx || cell_y[j] != cy || j == static_cast<int>(i)) continue;
+                    f(j);
+                }
+            }
+        }
+    }
+
+private:
+    size_t bucket(int cx, int cy) const {
+        const unsigned int h = static_cast<unsigned int>(cx) * 73856093u ^
+                               static_cast<unsigned int>(cy) * 19349663u;
+        return h & mask;
+    }
+
+    // buckets [begin, end) of a chunk
+    size_t chunk_begin(int chunk) const { return (mask + 1) * chunk / chunks; }
+    size_t chunk_end(int chunk) const { return (mask + 1) * (chunk + 1) / chunks; }
+
+    int chunks = 0;
+    size_t mask = 0;                // number of buckets - 1, a power of 2
+    std::vector<int> cell_x, cell_y;
+    std::vector<int> body_bucket;
+    std::unique_ptr<std::atomic<int>[]> slots;  // per bucket: count, then next slot
+    std::vector<int> chunk_bodies;  // bodies in each chunk of buckets
+    std::vector<int> bucket_begin;  // bodies of bucket b are sorted[bucket_begin[b], [b + 1])
+    std::vector<int> sorted;
+};
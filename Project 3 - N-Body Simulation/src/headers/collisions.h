@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "collision_grid.h"
+#include "physics.h"
+
+/*
+ * Body-body collisions in two phases, so that threads take no locks and the
+ * result depends neither on their number nor on their timing:
+ *     collisions.detect(..., chunk, begin, end);    // for every chunk, after all bodies moved
+ *     collisions.resolve(m, pos, v, chunk);         // for every chunk, after all detected
+ * Detection only reads positions and lists the partners of the bodies
+ * [begin, end) of a chunk. Resolution bounces each of those bodies off its
+ * partners in the order of their indices, changing only the body itself,
+ * see bounce_off(); a pair is found from both of its sides, so each body
+ * is bounced by the chunk that holds it.
+ */
+
+class Collisions {
+public:
+    // set the number of chunks
+    void resize(int n_chunks);
+
+    // partners of bodies [begin, end) among all n bodies
+    void detect(const std::vector<Point>& pos, size_t n, int chunk, size_t begin, size_t end);
+
+    // partners of bodies [begin, end) in the 3x3 cells of the grid around them
+    void detect(const CollisionGrid& grid, const std::vector<Point>& pos, int chunk, size_t begin,
+                size_t end);
+
+    // bounce the bodies of a chunk off their partners
+    void resolve(const std::vector<double>& m, std::vector<Point>& pos, std::vector<Velocity>& v,
+                 int chunk) const;
+
+    // append the bodies of a chunk that have partners, i.e. that resolve() moves, in order
+    void bounced(int chunk, std::vector<int>& bodies) const;
+
+private:
+    struct Contact {
+        int body;
+        int partner;
+    };
+
+    std::vector<std::vector<Contact>> contacts;  // per chunk, sorted by body and partner
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <random>
 #include <string>
 #include <vector>
@@ -24,6 +25,43 @@ extern std::vector<Point> pos;
 // velocity vector
 extern std::vector<Velocity> v;
 
+// force computation, chosen by --force=<direct|bh>
+enum class ForceEngine { Direct, BarnesHut };
+extern ForceEngine force_engine;
+// opening angle of the Barnes-Hut engine, --theta
+extern double theta;
+// body-body collision detection, chosen by --collision=<direct|grid>
+enum class CollisionEngine { Direct, Grid };
+extern CollisionEngine collision_engine;
+// bodies j per tile and bodies i per block of the direct sum, --tile and --block,
+// 0 sizes them to the L1 and L2 caches
+extern int tile_size;
+extern int block_size;
+// arithmetic of the direct sum, --precision=<double|float|mixed>, see bodies.h
+enum class Precision { Double, Float, Mixed };
+extern Precision precision;
+// run the same simulation in double precision alongside and report how far the bodies
+// drift from it, --validate
+extern bool validate;
+// a checkpoint every this many iterations into checkpoint_path, 0 for none, --checkpoint
+// and --checkpoint-file; --restart continues the run saved in restart_path, see checkpoint.h
+extern int checkpoint_interval;
+extern std::string checkpoint_path;
+extern std::string restart_path;
+// seed of the initial data, --seed, drawn at random without it; saved in checkpoints
+extern uint64_t seed;
+// initial data read from this file instead of generated, --input, see checkpoint.h
+extern std::string input_path;
+
+// set the options given as --key=value and return the other arguments
+std::vector<char*> parse_args(int argc, char** argv);
+
+// the initial bodies [begin, end), body i is stored at m[i - begin], pos[i - begin] and
+// v[i - begin]; a body only depends on the seed and its index, so every rank and thread can
+// generate its own bodies and gets the same ones as a single process
+void generate_bodies(double* m, Point* pos, Velocity* v, int begin, int end);
+
+// all n bodies, on the calling thread
 void generate_data(std::vector<double>& m, std::vector<Point>& pos, std::vector<Velocity>& v,
                    int n);
 
@@ -1,10 +1,20 @@
 /*
     Here is a tool to help you store running results to file system for further analysis and reproducing.
+    Frames go to <path>/frames.bin in binary: one FrameHeader, then for every frame the x
+    coordinates of all bodies followed by their y coordinates, as float or double. The number
+    of frames follows from the file size, readers ignore a partly written last frame.
+
+    save_frame() only copies the coordinates into one of two buffers. A background thread
+    writes a full buffer with one large write while the simulation fills the other one, so
+    the simulation only waits if it produces frames faster than the disk takes them.
     API:
-        Create a logger: 
-            Logger l = Logger(const char* version, int n_body_, int x_bound_, int y_bound_);
+        Create a logger:
+            Logger l = Logger(const char* version, int n_body_, int x_bound_, int y_bound_,
+                              bool single_ = false);  // single_: store floats
         Save a new frame:
-            l.save_frame(double* x, double* y);
+            l.save_frame(const double* x, const double* y);
+            l.save_frame(&pos[0].x, &pos[0].y, 2);  // every 2nd double, e.g. of a Point array
+        Buffered frames are written when the logger is destroyed.
     Example:
         Logger l = Logger("cuda", 10000, 4000, 4000);
         for (int i = 0; i < n_iterations; i++){
@@ -13,13 +23,34 @@
         }
 */
 
+#pragma once
+
 #include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <fstream>
-#include <iomanip>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+
+struct FrameHeader {
+    char magic[8];          // FRAME_MAGIC
+    uint32_t scalar_bytes;  // 4 for float, 8 for double coordinates
+    uint32_t n_body;
+    double x_bound;
+    double y_bound;
+    char version[32];       // name of the implementation, 0-terminated
+};
+static_assert(sizeof(FrameHeader) == 64, "FrameHeader is written as is");
+
+constexpr char FRAME_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'F', 'R', 'M'};
 
 
 class Logger {
@@ -28,36 +59,60 @@ class Logger {
         int x_bound;
         int y_bound;
         int current_iteration;
+        bool single;
         std::string version;
         std::string start_time;
         std::string root_path = "./checkpoints/";
         std::string path;
-        Logger(const char* version, int n_body_, int x_bound_, int y_bound_);
-        void save_frame(double* x, double* y);
-        void update_metadata();
+        Logger(const char* version, int n_body_, int x_bound_, int y_bound_, bool single_ = false);
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+        ~Logger();
+        void save_frame(const double* x, const double* y, size_t stride = 1);
         int is_exist(const char* path);
+
+    private:
+        // a buffer holds as many frames as fit in about this many bytes, at least one
+        static constexpr size_t BUFFER_BYTES = 8 << 20;
+
+        template <typename T>
+        void copy_frame(const double* x, const double* y, size_t stride, unsigned char* out);
+        void hand_over();
+        void write_loop();
+
+        std::ofstream file;
+        size_t frame_bytes;
+        std::vector<unsigned char> buffers[2];
+        int filling = 0;     // the buffer save_frame() copies to
+        size_t filled = 0;   // its bytes holding frames
+        size_t pending = 0;  // bytes of the other buffer the writer has yet to write
+        bool done = false;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread writer;
 };
 
 
 /* Implementation */
 
 
-int Logger::is_exist(const char* path){
+inline int Logger::is_exist(const char* path){
     return !access(path, F_OK);
 }
 
 
-Logger::Logger(const char* version_, int n_body_, int x_bound_, int y_bound_){
-    
+inline Logger::Logger(const char* version_, int n_body_, int x_bound_, int y_bound_, bool single_){
+
     version = version_;
     n_body = n_body_;
     x_bound = x_bound_;
     y_bound = y_bound_;
     current_iteration = 0;
+    single = single_;
 
     time_t t = time(0);
     char tmp[32];
-    strftime(tmp, sizeof(tmp), "%Y%m%d%H%M%S",localtime(&t)); 
+    strftime(tmp, sizeof(tmp), "%Y%m%d%H%M%S",localtime(&t));
     start_time = tmp;
 
     path = root_path + version + "_" + std::to_string(n_body) + "_" + start_time + "/";
@@ -76,31 +131,93 @@ Logger::Logger(const char* version_, int n_body_, int x_bound_, int y_bound_){
         }
     }
 
+    FrameHeader header{};
+    std::memcpy(header.magic, FRAME_MAGIC, sizeof(header.magic));
+    header.scalar_bytes = single ? sizeof(float) : sizeof(double);
+    header.n_body = n_body;
+    header.x_bound = x_bound;
+    header.y_bound = y_bound;
+    version.copy(header.version, sizeof(header.version) - 1);
+
+    file.open(path + "frames.bin", std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file) std::cout << "cannot open " << path << "frames.bin" << std::endl;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    frame_bytes = 2 * static_cast<size_t>(n_body) * header.scalar_bytes;
+    const size_t frames = std::max<size_t>(BUFFER_BYTES / std::max<size_t>(frame_bytes, 1), 1);
+    buffers[0].resize(frames * frame_bytes);
+    buffers[1].resize(frames * frame_bytes);
+
+    writer = std::thread(&Logger::write_loop, this);
 };
 
 
-void Logger::save_frame(double* x, double* y){
-    std::setprecision(15);
-    std::string f_path = path + "data.txt";
-    std::cout << path << std::endl;
-    std::ofstream f(f_path, std::ios::app | std::ios::binary);
-    for (int i = 0; i < n_body; i++){
-        f << std::to_string(x[i]) << std::endl << std::to_string(y[i]) << std::endl;
+inline Logger::~Logger(){
+    if (filled > 0) hand_over();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
     }
-    f.close();
-    update_metadata();
-    return;
+    cv.notify_all();
+    writer.join();
+    file.close();
 };
 
 
-void Logger::update_metadata(){
-    std::string f_path = path + "metadata.txt";
-    std::ofstream f(f_path, std::ios::out);
+inline void Logger::save_frame(const double* x, const double* y, size_t stride){
+    unsigned char* out = buffers[filling].data() + filled;
+    if (single) {
+        copy_frame<float>(x, y, stride, out);
+    } else {
+        copy_frame<double>(x, y, stride, out);
+    }
+    filled += frame_bytes;
     current_iteration ++;
-    f << version << std::endl << n_body << std::endl 
-    << x_bound << std::endl << y_bound << std::endl 
-    << current_iteration;
-    f.close();
+    // the next frame would not fit, let the writer have this buffer
+    if (filled + frame_bytes > buffers[filling].size()) hand_over();
     return;
 };
 
+
+template <typename T>
+void Logger::copy_frame(const double* x, const double* y, size_t stride, unsigned char* out){
+    // all x, then all y
+    for (int i = 0; i < n_body; i++){
+        const T value = static_cast<T>(x[i * stride]);
+        std::memcpy(out + i * sizeof(T), &value, sizeof(T));
+    }
+    out += n_body * sizeof(T);
+    for (int i = 0; i < n_body; i++){
+        const T value = static_cast<T>(y[i * stride]);
+        std::memcpy(out + i * sizeof(T), &value, sizeof(T));
+    }
+};
+
+
+inline void Logger::hand_over(){
+    std::unique_lock<std::mutex> lock(mutex);
+    // the writer must be done with the other buffer before it can be filled
+    cv.wait(lock, [this] { return pending == 0; });
+    pending = filled;
+    filling = 1 - filling;
+    filled = 0;
+    lock.unlock();
+    cv.notify_all();
+};
+
+
+inline void Logger::write_loop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return pending > 0 || done; });
+        if (pending == 0) return;
+        // hand_over() switched buffers, the full one is the one not being filled
+        const unsigned char* data = buffers[1 - filling].data();
+        const size_t bytes = pending;
+        lock.unlock();
+        file.write(reinterpret_cast<const char*>(data), bytes);
+        lock.lock();
+        pending = 0;
+        cv.notify_all();
+    }
+};
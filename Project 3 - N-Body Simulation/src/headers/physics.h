@@ -67,8 +67,14 @@ Force get_force(double m1, double m2, const Point& pos1, const Point& pos2);
 
 void handle_wall_collision(Point& pos, Velocity& v);
 
+// the part of a bounce that changes body 1, it does not depend on the state of body 2
+void bounce_off(double m1, double m2, Point& pos1, Velocity& v1);
+
 void do_bounce(double m1, double m2, Point& pos1, Point& pos2, Velocity& v1, Velocity& v2);
 
+// move body i and bounce it off the walls, but not off other bodies
+void move_body(std::vector<Point>& pos, std::vector<Velocity>& v, size_t i);
+
 void update_position(const std::vector<double>& m, std::vector<Point>& pos,
                      std::vector<Velocity>& v, size_t n, size_t i);
 
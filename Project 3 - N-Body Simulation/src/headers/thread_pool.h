@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/*
+ * Building blocks of the persistent thread pool of the pthread target.
+ *
+ * SpinBarrier: a sense-reversing barrier. The last thread to arrive flips
+ * the sense (a generation counter) and releases the others; waiting threads
+ * spin on the sense for a short while, which is enough between the short
+ * phases of an iteration, and then sleep on it with a futex. Threads do not
+ * spin when there are more of them than cores.
+ *
+ * ChunkQueues: the chunks of a batch of tasks, e.g. body ranges. Every
+ * thread starts with a contiguous share, takes chunks from its front, and
+ * when it runs out steals from the back of the other threads' shares, so
+ * that uneven chunks do not leave threads idle.
+ */
+
+class SpinBarrier {
+public:
+    // set the number of threads that meet at the barrier
+    void init(int count);
+
+    void wait();
+
+private:
+    int count = 1;
+    int spin_limit = 0;
+    std::atomic<int> remaining{1};
+    std::atomic<uint32_t> sense{0};
+    std::atomic<int> sleepers{0};
+};
+
+class ChunkQueues {
+public:
+    // n_chunks chunks shared by n_threads threads
+    void resize(size_t n_chunks, int n_threads);
+
+    // give a thread its share again, all shares must be refilled before a batch
+    void refill(int thread);
+
+    // take a chunk, false when there are none left
+    bool pop(int thread, size_t& chunk);
+
+private:
+    // chunks [front, back) of a thread, packed into one word so that the owner
+    // and thieves can take from it with a single compare-and-swap
+    struct alignas(64) Share {
+        std::atomic<uint64_t> range{0};
+    };
+
+    bool take(Share& share, bool front, size_t& chunk);
+
+    size_t chunks = 0;
+    int threads = 0;
+    std::unique_ptr<Share[]> shares;
+};
@@ -2,6 +2,11 @@
 #include <iostream>
 #include <mpi.h>
 
+#include "barnes_hut.h"
+#include "bodies.h"
+#include "checkpoint_mpi.h"
+#include "collision_grid.h"
+#include "collisions.h"
 #include "common.h"
 
 int rank;
@@ -12,19 +17,113 @@ std::vector<int> displs;
 
 MPI_Datatype MPI_VECTOR; // MPI data type for struct Vector
 
+// a body bounced off another one after its moved position was exchanged, see start_exchange()
+struct Bounce {
+    int body;
+    Point pos;
+};
+std::vector<Bounce> outgoing;  // of this rank's bodies
+std::vector<Bounce> incoming;  // of all ranks
+std::vector<int> incoming_bytes, incoming_offsets;  // per rank, kept until the gather is done
+MPI_Request exchange = MPI_REQUEST_NULL; // gather of the bounces of the last iteration
+
+BarnesHut tree;
+CollisionGrid grid;
+Collisions collisions;
+Bodies bodies;
+Forces forces;
+
+void exchange_positions() {
+    // every rank sends the moved positions of its bodies to all others, in place; collisions
+    // are only detected once all bodies moved, as in the other targets
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, pos.data(), counts.data(), displs.data(),
+                   MPI_VECTOR, MPI_COMM_WORLD);
+}
+
+void start_exchange() {
+    // the others already have the moved positions, only those of the bodies bounced since then
+    // change; the sizes are gathered first, the bounces themselves arrive in the background
+    outgoing.clear();
+    std::vector<int> bounced;
+    collisions.bounced(0, bounced);
+    for (const int i : bounced) {
+        outgoing.push_back(Bounce{i, pos[i]});
+    }
+
+    const int bytes = static_cast<int>(outgoing.size() * sizeof(Bounce));
+    incoming_bytes.resize(world_size);
+    incoming_offsets.assign(world_size + 1, 0);
+    MPI_Allgather(&bytes, 1, MPI_INT, incoming_bytes.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (int r = 0; r < world_size; ++r) {
+        incoming_offsets[r + 1] = incoming_offsets[r] + incoming_bytes[r];
+    }
+    incoming.resize(incoming_offsets[world_size] / sizeof(Bounce));
+    MPI_Iallgatherv(outgoing.data(), bytes, MPI_BYTE, incoming.data(), incoming_bytes.data(),
+                    incoming_offsets.data(), MPI_BYTE, MPI_COMM_WORLD, &exchange);
+}
+
+void finish_exchange() {
+    MPI_Wait(&exchange, MPI_STATUS_IGNORE);
+    for (const Bounce& bounce : incoming) {
+        pos[bounce.body] = bounce.pos;
+    }
+    incoming.clear();
+}
+
 void update_positions(const std::vector<double>& m, std::vector<Point>& pos,
                       std::vector<Velocity>& v, const size_t n, const size_t begin,
                       const size_t end) {
+    // move the local bodies, then find and resolve their collisions among all moved bodies,
+    // see collisions.h; bodies of other ranks are bounced by their owners
     for (size_t i = begin; i < end; ++i) {
-        update_position(m, pos, v, n, i);
+        move_body(pos, v, i);
     }
+    exchange_positions();
+    collisions.detect(pos, n, 0, begin, end);
+    collisions.resolve(m, pos, v, 0);
 }
 
 void update_velocities(const std::vector<double>& m, const std::vector<Point>& pos,
                        std::vector<Velocity>& v, const size_t n, const size_t begin,
                        const size_t end) {
+    // every rank sums whole rows for its own bodies, starting with the forces among
+    // them while the bounces of the other bodies are still being exchanged
+    bodies.load_positions(pos, begin, end);
+    forces.clear(n);
+    accumulate_row_forces(bodies, forces, begin, end, begin, end);
+    finish_exchange();
+    bodies.load_positions(pos, 0, begin);
+    bodies.load_positions(pos, end, n);
+    accumulate_row_forces(bodies, forces, begin, end, 0, begin);
+    accumulate_row_forces(bodies, forces, begin, end, end, n);
+    for (size_t i = begin; i < end; ++i) {
+        // v += at
+        v[i] += (forces[i] / m[i]) * DT;
+    }
+}
+
+void update_positions(CollisionGrid& grid, const std::vector<double>& m,
+                      std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n,
+                      const size_t begin, const size_t end) {
+    // move the local bodies, then look for collisions around them, as in update_positions()
     for (size_t i = begin; i < end; ++i) {
-        update_velocity(m, pos, v, n, i);
+        move_body(pos, v, i);
+    }
+    exchange_positions();
+    grid.build(pos, n);
+    collisions.detect(grid, pos, 0, begin, end);
+    collisions.resolve(m, pos, v, 0);
+}
+
+void update_velocities(BarnesHut& tree, const std::vector<double>& m,
+                       const std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n,
+                       const size_t begin, const size_t end) {
+    // every rank holds all positions and builds the whole tree
+    finish_exchange();
+    tree.build(m, pos, n);
+
+    for (size_t i = begin; i < end; ++i) {
+        update_velocity(tree, m, v, i, theta);
     }
 }
 
@@ -32,34 +131,58 @@ void do_one_iteration() {
     const int begin = displs[rank], end = displs[rank + 1];
 
     // update velocities
-    update_velocities(m, pos, v, n_body, begin, end);
-    // broadcast updated velocities
-    for (int i = 0; i < world_size; ++i) {
-        MPI_Bcast(&v[displs[i]], counts[i], MPI_VECTOR, i, MPI_COMM_WORLD);
-        MPI_Barrier(MPI_COMM_WORLD);
+    if (force_engine == ForceEngine::BarnesHut) {
+        update_velocities(tree, m, pos, v, n_body, begin, end);
+    }
+    else {
+        update_velocities(m, pos, v, n_body, begin, end);
     }
-
     // update positions
-    update_positions(m, pos, v, n_body, begin, end);
-    // broadcast updated positions and velocities
-    for (int i = 0; i < world_size; ++i) {
-        MPI_Bcast(&pos[displs[i]], counts[i], MPI_VECTOR, i, MPI_COMM_WORLD);
-        MPI_Bcast(&v[displs[i]], counts[i], MPI_VECTOR, i, MPI_COMM_WORLD);
-        MPI_Barrier(MPI_COMM_WORLD);
+    if (collision_engine == CollisionEngine::Grid) {
+        update_positions(grid, m, pos, v, n_body, begin, end);
+    }
+    else {
+        update_positions(m, pos, v, n_body, begin, end);
     }
+    // only positions are exchanged: forces need no velocities, and collisions change
+    // the velocity of the rank's own bodies only
+    start_exchange();
+}
+
+int init_data() {
+    // every rank holds all bodies; it reads or generates them itself, generated bodies only
+    // depend on the seed, so all ranks get the same ones without sending them
+    m.resize(n_body);
+    pos.resize(n_body, Point{});
+    v.resize(n_body, Velocity{});
+    if (!restart_path.empty()) {
+        return load_checkpoint(restart_path, m.data(), pos.data(), v.data(), 0, n_body);
+    }
+    if (!input_path.empty()) {
+        load_bodies(input_path, m.data(), pos.data(), v.data(), 0, n_body);
+    }
+    else {
+        generate_bodies(m.data(), pos.data(), v.data(), 0, n_body);
+    }
+    return 0;
+}
+
+void save_checkpoint(MpiCheckpointWriter& checkpoints, const int iteration) {
+    // every rank writes its own bodies; pos is no MPI buffer, bounces arrive in incoming
+    const int begin = displs[rank];
+    checkpoints.save(iteration, m.data() + begin, pos.data() + begin, v.data() + begin, begin,
+                     counts[rank]);
 }
 
 void master() {
     using namespace std::chrono;
 
-    generate_data(m, pos, v, n_body);
+    const int first = init_data();
+    bodies.load_masses(m, n_body);
+    collisions.resize(1);
 
-    // copy data to slaves
-    MPI_Bcast(m.data(), n_body, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    MPI_Bcast(pos.data(), n_body, MPI_VECTOR, 0, MPI_COMM_WORLD);
-    MPI_Bcast(v.data(), n_body, MPI_VECTOR, 0, MPI_COMM_WORLD);
-
-    for (int i = 0; i < n_iteration; i++) {
+    MpiCheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; i++) {
         high_resolution_clock::time_point t1 = high_resolution_clock::now();
 
         do_one_iteration();
@@ -69,36 +192,41 @@ void master() {
 
         std::cout << "Iteration " << i << ", elapsed time: " << time_span.count() << std::endl;
 
+        if (checkpoint_due(i + 1)) save_checkpoint(checkpoints, i + 1);
+
 #ifdef GUI
+        finish_exchange();
         glut_update();
 #endif
     }
+    finish_exchange();
 }
 
 void slave() {
-    // initialize global variables in slave processes
-    m.resize(n_body);
-    pos.resize(n_body, Point{});
-    v.resize(n_body, Velocity{});
-    // receive data from master
-    MPI_Bcast(m.data(), n_body, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    MPI_Bcast(pos.data(), n_body, MPI_VECTOR, 0, MPI_COMM_WORLD);
-    MPI_Bcast(v.data(), n_body, MPI_VECTOR, 0, MPI_COMM_WORLD);
+    const int first = init_data();
+    bodies.load_masses(m, n_body);
+    collisions.resize(1);
 
-    for (int i = 0; i < n_iteration; ++i) {
+    MpiCheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; ++i) {
         do_one_iteration();
+        if (checkpoint_due(i + 1)) save_checkpoint(checkpoints, i + 1);
     }
+    finish_exchange();
 }
 
 int main(int argc, char* argv[]) {
     const std::string prog_name = "MPI";
 
-    n_body = std::stoi(argv[1]);
-    n_iteration = std::stoi(argv[2]);
+    const std::vector<char*> params = parse_args(argc, argv);
+    n_body = std::stoi(params[0]);
+    n_iteration = std::stoi(params[1]);
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    // all ranks generate with the seed of rank 0
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
 
     // create a MPI data type for Vector
     MPI_Type_contiguous(2, MPI_DOUBLE, &MPI_VECTOR);
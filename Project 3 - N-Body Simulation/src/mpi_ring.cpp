@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mpi.h>
+#include <utility>
+
+#include "bodies.h"
+#include "checkpoint_mpi.h"
+#include "common.h"
+
+/*
+ * MPI with O(n / p) memory per rank.
+ * Every rank holds only its own slice of m, pos and v. The positions and
+ * masses travel around a ring of ranks in blocks: in each of the p steps a
+ * rank uses the block it holds and passes it on to its right neighbour,
+ * while it receives the next one from its left neighbour.
+ */
+
+int rank;
+int world_size;
+
+std::vector<int> counts;
+std::vector<int> displs;
+
+MPI_Datatype MPI_VECTOR; // MPI data type for struct Vector
+
+Bodies local;        // SoA copy of this rank's bodies
+Bodies blocks[2];    // the block in use and the one being received
+Forces forces;
+
+struct Contact {
+    int body;             // local index
+    int partner;          // global index
+    double partner_mass;
+};
+std::vector<Contact> contacts; // collisions of the local bodies in this iteration
+
+template <typename Visit>
+void pass_around_ring(Visit visit) {
+    // this rank's own block first, then the blocks of the ranks to the left, one per step
+    const int left = (rank + world_size - 1) % world_size;
+    const int right = (rank + 1) % world_size;
+    Bodies* current = &blocks[0];
+    Bodies* next = &blocks[1];
+    *current = local;
+
+    for (int step = 0; step < world_size; ++step) {
+        const int owner = (rank + world_size - step) % world_size;
+        MPI_Request requests[6];
+        int n_requests = 0;
+        if (step + 1 < world_size) {
+            next->resize(counts[(owner + world_size - 1) % world_size]);
+            aligned_vector<double>* const parts[2][3] = {
+                {&current->x, &current->y, &current->m},
+                {&next->x, &next->y, &next->m},
+            };
+            for (int part = 0; part < 3; ++part) {
+                aligned_vector<double>& out = *parts[0][part];
+                aligned_vector<double>& in = *parts[1][part];
+                MPI_Irecv(in.data(), static_cast<int>(in.size()), MPI_DOUBLE, left, part,
+                          MPI_COMM_WORLD, &requests[n_requests++]);
+                MPI_Isend(out.data(), static_cast<int>(out.size()), MPI_DOUBLE, right, part,
+                          MPI_COMM_WORLD, &requests[n_requests++]);
+            }
+        }
+
+        // use this block while the next one is in flight
+        visit(*current, owner);
+
+        MPI_Waitall(n_requests, requests, MPI_STATUSES_IGNORE);
+        // blocks travel in double, the float kernels need their own copies
+        if (step + 1 < world_size) next->load_floats(0, next->size());
+        std::swap(current, next);
+    }
+}
+
+void update_velocities(const std::vector<double>& m, std::vector<Velocity>& v, const size_t n) {
+    forces.clear(n);
+    pass_around_ring([](const Bodies& block, int) {
+        accumulate_block_forces(local, block, forces);
+    });
+    for (size_t i = 0; i < n; ++i) {
+        // v += at
+        v[i] += (forces[i] / m[i]) * DT;
+    }
+}
+
+void update_positions(const std::vector<double>& m, std::vector<Point>& pos,
+                      std::vector<Velocity>& v, const size_t n) {
+    // move all local bodies, then find their partners in every block and bounce them
+    // in the order of the partners' indices, as Collisions does, see collisions.h
+    for (size_t i = 0; i < n; ++i) {
+        move_body(pos, v, i);
+    }
+    local.load_positions(pos, 0, n);
+
+    contacts.clear();
+    pass_around_ring([&](const Bodies& block, const int owner) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < block.size(); ++j) {
+                if (owner == rank && i == j) continue;
+                const Point pos_j{block.x[j], block.y[j]};
+                if (pos[i].sqr_dist(pos_j) < COLLISION_DIST2) {
+                    const int partner = displs[owner] + static_cast<int>(j);
+                    contacts.push_back(Contact{static_cast<int>(i), partner, block.m[j]});
+                }
+            }
+        }
+    });
+    std::sort(contacts.begin(), contacts.end(), [](const Contact& a, const Contact& b) {
+        return a.body != b.body ? a.body < b.body : a.partner < b.partner;
+    });
+    // a body of another rank is bounced by its owner, only body i changes here
+    for (const Contact& contact : contacts) {
+        const int i = contact.body;
+        bounce_off(m[i], contact.partner_mass, pos[i], v[i]);
+    }
+    local.load_positions(pos, 0, n);
+}
+
+void do_one_iteration() {
+    const size_t n = counts[rank];
+    update_velocities(m, v, n);
+    update_positions(m, pos, v, n);
+}
+
+#ifdef GUI
+void draw() {
+    // only rank 0 draws, it gathers the positions for that
+    std::vector<Point> frame(rank == 0 ? n_body : 0);
+    MPI_Gatherv(pos.data(), counts[rank], MPI_VECTOR, frame.data(), counts.data(),
+                displs.data(), MPI_VECTOR, 0, MPI_COMM_WORLD);
+    if (rank == 0) glut_update(frame.data(), frame.size());
+}
+#endif
+
+int init_data() {
+    // every rank reads or generates only its own slice; generated bodies only depend on the
+    // seed, so the slices are those of a single process
+    const int n = counts[rank];
+    m.resize(n);
+    pos.resize(n, Point{});
+    v.resize(n, Velocity{});
+    int first = 0;
+    if (!restart_path.empty()) {
+        first = load_checkpoint(restart_path, m.data(), pos.data(), v.data(), displs[rank], n);
+    }
+    else if (!input_path.empty()) {
+        load_bodies(input_path, m.data(), pos.data(), v.data(), displs[rank], n);
+    }
+    else {
+        generate_bodies(m.data(), pos.data(), v.data(), displs[rank], displs[rank] + n);
+    }
+
+    local.load_masses(m, n);
+    local.load_positions(pos, 0, n);
+    return first;
+}
+
+void save_checkpoint(MpiCheckpointWriter& checkpoints, const int iteration) {
+    // every rank writes its slice
+    checkpoints.save(iteration, m.data(), pos.data(), v.data(), displs[rank], counts[rank]);
+}
+
+void master() {
+    using namespace std::chrono;
+
+    const int first = init_data();
+
+    MpiCheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; i++) {
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+        do_one_iteration();
+
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        duration<double> time_span = t2 - t1;
+
+        std::cout << "Iteration " << i << ", elapsed time: " << time_span.count() << std::endl;
+
+        if (checkpoint_due(i + 1)) save_checkpoint(checkpoints, i + 1);
+
+#ifdef GUI
+        draw();
+#endif
+    }
+}
+
+void slave() {
+    const int first = init_data();
+
+    MpiCheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; ++i) {
+        do_one_iteration();
+        if (checkpoint_due(i + 1)) save_checkpoint(checkpoints, i + 1);
+#ifdef GUI
+        draw();
+#endif
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const std::string prog_name = "MPI-Ring";
+
+    const std::vector<char*> params = parse_args(argc, argv);
+    n_body = std::stoi(params[0]);
+    n_iteration = std::stoi(params[1]);
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    // all ranks generate with the seed of rank 0
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    if (rank == 0 && (force_engine != ForceEngine::Direct ||
+                      collision_engine != CollisionEngine::Direct)) {
+        std::cerr << "mpi_ring only has the direct force sum and collision check\n";
+    }
+
+    // create a MPI data type for Vector
+    MPI_Type_contiguous(2, MPI_DOUBLE, &MPI_VECTOR);
+    MPI_Type_commit(&MPI_VECTOR);
+
+    // initialize vectors for data splitting
+    counts.resize(world_size);
+    displs.resize(world_size + 1);
+    split_data(counts, displs, n_body, world_size);
+
+    if (rank == 0) {
+#ifdef GUI
+        glut_init(argc, argv, prog_name);
+#endif
+
+        TIME_IT(master();)
+    }
+    else {
+        slave();
+    }
+
+    if (rank == 0) {
+        print_information(prog_name, n_body, world_size);
+
+#ifdef GUI
+        glut_main_loop();
+#endif
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -1,36 +1,141 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 #include <omp.h>
 
+#include "barnes_hut.h"
+#include "bodies.h"
+#include "checkpoint.h"
+#include "collision_grid.h"
+#include "collisions.h"
 #include "common.h"
 
 int n_omp_threads;
 
+BarnesHut tree;
+CollisionGrid grid;
+Collisions collisions;
+Bodies bodies;
+std::vector<Forces> forces; // one buffer per group of rows, see first_row()
+
 
 void update_position(const std::vector<double>& m, std::vector<Point>& pos,
                      std::vector<Velocity>& v, const size_t n) {
+    // move all bodies, then find and resolve collisions, one chunk of bodies per thread,
+    // see collisions.h
+    const int chunks = n_omp_threads;
+#pragma omp parallel
+    {
+        #pragma omp for
+        for (int i = 0; i < n; ++i) {
+            move_body(pos, v, i);
+        }
+        #pragma omp for
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            collisions.detect(pos, n, chunk, n * chunk / chunks, n * (chunk + 1) / chunks);
+        }
+        #pragma omp for
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            collisions.resolve(m, pos, v, chunk);
+        }
+    }
+}
+
+void update_position(CollisionGrid& grid, const std::vector<double>& m,
+                     std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n) {
+    // one chunk of bodies per thread for the counting sort of the grid
+    const int chunks = n_omp_threads;
 #pragma omp parallel for
-    for (int i = 0; i < n; ++i) {
-        // X = X + V * dt
-        pos[i] += v[i] * DT;
-        // handle wall collision
-        handle_wall_collision(pos[i], v[i]);
-        // handle collision with other bodies and bounce
-        for (size_t j = 0; j < n; ++j) {
-            if (i == j) continue;
-            if (pos[i].sqr_dist(pos[j]) < COLLISION_DIST2) {
-                #pragma omp critical
-                { do_bounce(m[i], m[j], pos[i], pos[j], v[i], v[j]); }
-            }
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        const size_t begin = n * chunk / chunks, end = n * (chunk + 1) / chunks;
+        for (size_t i = begin; i < end; ++i) {
+            move_body(pos, v, i);
         }
+        grid.count(pos, chunk, begin, end);
+    }
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        grid.sum(chunk);
+    }
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        grid.prefix(chunk);
+    }
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        grid.scatter(chunk, n * chunk / chunks, n * (chunk + 1) / chunks);
+    }
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        grid.sort(chunk);
+    }
+
+    // collisions with the bodies of the neighbouring cells
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        collisions.detect(grid, pos, chunk, n * chunk / chunks, n * (chunk + 1) / chunks);
+    }
+#pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        collisions.resolve(m, pos, v, chunk);
     }
 }
 
+size_t first_row(const int group, const int groups, const size_t n) {
+    // row i has the n - 1 - i pairs (i, j > i), groups [0, group) take group / groups of
+    // the n^2 / 2 pairs
+    const double rest = 1 - static_cast<double>(group) / groups;
+    return std::min(n, static_cast<size_t>(std::round(n * (1 - std::sqrt(rest)))));
+}
+
 void update_velocity(const std::vector<double>& m, const std::vector<Point>& pos,
                      std::vector<Velocity>& v, const size_t n) {
+#pragma omp parallel
+    {
+        #pragma omp single
+        forces.resize(omp_get_num_threads());
+
+        // each thread packs its share of the positions
+        const int threads = omp_get_num_threads();
+        const int thread = omp_get_thread_num();
+        bodies.load_positions(pos, n * thread / threads, n * (thread + 1) / threads);
+        #pragma omp barrier
+
+        // every pair once, see accumulate_forces(). Rows get shorter, so the rows are cut
+        // into one group of about the same number of pairs per thread. A group always adds
+        // into its own buffer, block after block, so the sums do not depend on the timing
+        const size_t begin = first_row(thread, threads, n), end = first_row(thread + 1, threads, n);
+        Forces& f = forces[thread];
+        f.clear(n);
+        for (size_t i = begin; i < end; i += force_tiling().block) {
+            accumulate_forces(bodies, f, i, std::min(i + force_tiling().block, end));
+        }
+        #pragma omp barrier
+
+        // sum the buffers, always in the order of the groups
+        #pragma omp for
+        for (int i = 0; i < n; ++i) {
+            Force total{};
+            for (const Forces& buffer : forces) total += buffer[i];
+            // v += at
+            v[i] += (total / m[i]) * DT;
+        }
+    }
+}
+
+void update_velocity(BarnesHut& tree, const std::vector<double>& m,
+                     const std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n) {
+    tree.build_top(m, pos, n);
+#pragma omp parallel for schedule(dynamic)
+    for (int cell = 0; cell < tree.n_cells(); ++cell) {
+        tree.build_cell(cell);
+    }
+    tree.build_finish();
+
 #pragma omp parallel for
     for (int i = 0; i < n; ++i) {
-        update_velocity(m, pos, v, n, i);
+        update_velocity(tree, m, v, i, theta);
     }
 }
 
@@ -38,21 +143,54 @@ void update_velocity(const std::vector<double>& m, const std::vector<Point>& pos
 void master() {
     using namespace std::chrono;
 
-    generate_data(m, pos, v, n_body);
-
     omp_set_num_threads(n_omp_threads);
-    for (int i = 0; i < n_iteration; i++) {
+
+    int first = 0;
+    if (!restart_path.empty()) {
+        first = load_checkpoint(restart_path, m, pos, v);
+    }
+    else if (!input_path.empty()) {
+        load_bodies(input_path, m, pos, v);
+    }
+    else {
+        m.resize(n_body);
+        pos.resize(n_body, Point{});
+        v.resize(n_body, Velocity{});
+        // every body on its own, see generate_bodies()
+        #pragma omp parallel for
+        for (int i = 0; i < n_body; ++i) {
+            generate_bodies(&m[i], &pos[i], &v[i], i, i + 1);
+        }
+    }
+
+    bodies.load_masses(m, n_body);
+    grid.resize(n_body, n_omp_threads);
+    collisions.resize(n_omp_threads);
+    CheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; i++) {
         high_resolution_clock::time_point t1 = high_resolution_clock::now();
 
         // TODO: choose better threads configuration
-        update_velocity(m, pos, v, n_body);
-        update_position(m, pos, v, n_body);
+        if (force_engine == ForceEngine::BarnesHut) {
+            update_velocity(tree, m, pos, v, n_body);
+        }
+        else {
+            update_velocity(m, pos, v, n_body);
+        }
+        if (collision_engine == CollisionEngine::Grid) {
+            update_position(grid, m, pos, v, n_body);
+        }
+        else {
+            update_position(m, pos, v, n_body);
+        }
 
         high_resolution_clock::time_point t2 = high_resolution_clock::now();
         duration<double> time_span = t2 - t1;
 
         std::cout << "Iteration " << i << ", elapsed time: " << time_span.count() << '\n';
 
+        if (checkpoint_due(i + 1)) checkpoints.save(i + 1, m, pos, v);
+
 #ifdef GUI
         glut_update();
 #endif
@@ -63,9 +201,10 @@ void master() {
 int main(int argc, char* argv[]) {
     const std::string prog_name = "OpenMP";
 
-    n_body = std::stoi(argv[1]);
-    n_iteration = std::stoi(argv[2]);
-    n_omp_threads = std::stoi(argv[3]);
+    const std::vector<char*> params = parse_args(argc, argv);
+    n_body = std::stoi(params[0]);
+    n_iteration = std::stoi(params[1]);
+    n_omp_threads = std::stoi(params[2]);
 
 #ifdef GUI
     glut_init(argc, argv, prog_name);
@@ -6,6 +6,8 @@
 Force get_force(const double m1, const double m2, const Point& pos1, const Point& pos2) {
     const double dx = pos2.x - pos1.x, dy = pos2.y - pos1.y;
     const double r_sqr = dx * dx + dy * dy;
+    // bodies at the same position pull in no direction
+    if (r_sqr == 0) return Force{0, 0};
     const double r = sqrt(r_sqr);
     const double f = GRAVITY_CONST * m1 * m2 / (r_sqr + FLOAT_OP_ERROR);
     return Force{f * dx / r, f * dy / r};
@@ -30,25 +32,31 @@ void handle_wall_collision(Point& pos, Velocity& v) {
     }
 }
 
-void do_bounce(const double m1, const double m2, Point& pos1, Point& pos2, Velocity& v1,
-               Velocity& v2) {
+void bounce_off(const double m1, const double m2, Point& pos1, Velocity& v1) {
     // simple workaround: invert the speed
     v1.x = -v1.x;
     v1.y = -v1.y;
-    v2.x = -v2.x;
-    v2.y = -v2.y;
 
-    // move the bodies away from each other
+    // move the body away from the other one
     pos1 += v1 * DT;
-    pos2 += v2 * DT;
 }
 
-void update_position(const std::vector<double>& m, std::vector<Point>& pos,
-                     std::vector<Velocity>& v, const size_t n, const size_t i) {
+void do_bounce(const double m1, const double m2, Point& pos1, Point& pos2, Velocity& v1,
+               Velocity& v2) {
+    bounce_off(m1, m2, pos1, v1);
+    bounce_off(m2, m1, pos2, v2);
+}
+
+void move_body(std::vector<Point>& pos, std::vector<Velocity>& v, const size_t i) {
     // X = X + V * dt
     pos[i] += v[i] * DT;
     // handle wall collision
     handle_wall_collision(pos[i], v[i]);
+}
+
+void update_position(const std::vector<double>& m, std::vector<Point>& pos,
+                     std::vector<Velocity>& v, const size_t n, const size_t i) {
+    move_body(pos, v, i);
     // handle collision with other bodies and bounce
     for (size_t j = 0; j < n; ++j) {
         if (i == j) continue;
@@ -68,4 +76,4 @@ void update_velocity(const std::vector<double>& m, const std::vector<Point>& pos
     }
     // v += at
     v[i] += (f / m[i]) * DT;
-}
\ No newline at end of file
+}
@@ -1,58 +1,186 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <pthread.h>
 
+#include "barnes_hut.h"
+#include "bodies.h"
+#include "checkpoint.h"
+#include "collision_grid.h"
+#include "collisions.h"
 #include "common.h"
+#include "thread_pool.h"
 
 struct Args {
-    int begin;
-    int end;
+    int first;  // iterations done before, by the run this one continues
     int n_iterations;
+    int thread;
 };
 
 int n_thd; // number of threads
 
-pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_barrier_t inner_barrier;
-pthread_barrier_t barrier;
+// bodies are handed out in chunks of about n_body / n_chunks, see for_each_chunk()
+constexpr int CHUNKS_PER_THREAD = 4;
+size_t n_chunks;
 
+SpinBarrier inner_barrier; // the worker threads
+SpinBarrier barrier;       // the worker threads and the master, once per iteration
+ChunkQueues tasks[2];      // the chunks of the current batch and of the next one
+std::atomic<size_t> next_cell; // Barnes-Hut cells are taken in order
+
+BarnesHut tree;
+CollisionGrid grid;
+Collisions collisions;
+Bodies bodies;
+std::vector<Forces> forces; // one buffer per chunk of rows
+
+
+template <typename F>
+void for_each_chunk(const int thread, int& batch, F f) {
+    // call f(chunk, begin, end) for chunks of the bodies until none are left; the
+    // caller waits at a barrier before the next batch
+    ChunkQueues& queue = tasks[batch % 2];
+    size_t chunk;
+    while (queue.pop(thread, chunk)) {
+        f(chunk, n_body * chunk / n_chunks, n_body * (chunk + 1) / n_chunks);
+    }
+    // the other queue was used by the previous batch, which every thread has finished
+    tasks[(batch + 1) % 2].refill(thread);
+    ++batch;
+}
 
 void update_positions(const std::vector<double>& m, std::vector<Point>& pos,
-                      std::vector<Velocity>& v, const size_t n, const size_t begin,
-                      const size_t end) {
-    for (size_t i = begin; i < end; ++i) {
-        // X = X + V * dt
-        pos[i] += v[i] * DT;
-        // handle wall collision
-        handle_wall_collision(pos[i], v[i]);
-        // handle collision with other bodies and bounce
-        for (size_t j = 0; j < n; ++j) {
-            if (i == j) continue;
-            if (pos[i].sqr_dist(pos[j]) < COLLISION_DIST2) {
-                pthread_mutex_lock(&data_mutex);
-                do_bounce(m[i], m[j], pos[i], pos[j], v[i], v[j]);
-                pthread_mutex_unlock(&data_mutex);
-            }
+                      std::vector<Velocity>& v, const size_t n, const int thread, int& batch) {
+    // move all bodies, then find and resolve collisions, see collisions.h
+    for_each_chunk(thread, batch, [&](size_t, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            move_body(pos, v, i);
         }
-    }
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, const size_t begin, const size_t end) {
+        collisions.detect(pos, n, chunk, begin, end);
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, size_t, size_t) {
+        collisions.resolve(m, pos, v, chunk);
+    });
+}
+
+void update_positions(CollisionGrid& grid, const std::vector<double>& m,
+                      std::vector<Point>& pos, std::vector<Velocity>& v, const int thread,
+                      int& batch) {
+    // move the bodies and sort them into the grid, chunk by chunk
+    for_each_chunk(thread, batch, [&](const size_t chunk, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            move_body(pos, v, i);
+        }
+        grid.count(pos, chunk, begin, end);
+    });
+    inner_barrier.wait();
+    // the chunks of buckets are handed out like the chunks of bodies
+    for_each_chunk(thread, batch, [&](const size_t chunk, size_t, size_t) {
+        grid.sum(chunk);
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, size_t, size_t) {
+        grid.prefix(chunk);
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, const size_t begin, const size_t end) {
+        grid.scatter(chunk, begin, end);
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, size_t, size_t) {
+        grid.sort(chunk);
+    });
+    inner_barrier.wait();
+
+    // collisions with the bodies of the neighbouring cells
+    for_each_chunk(thread, batch, [&](const size_t chunk, const size_t begin, const size_t end) {
+        collisions.detect(grid, pos, chunk, begin, end);
+    });
+    inner_barrier.wait();
+    for_each_chunk(thread, batch, [&](const size_t chunk, size_t, size_t) {
+        collisions.resolve(m, pos, v, chunk);
+    });
 }
 
 void update_velocities(const std::vector<double>& m, const std::vector<Point>& pos,
-                       std::vector<Velocity>& v, const size_t n, const size_t begin,
-                       const size_t end) {
-    for (size_t i = begin; i < end; ++i) {
-        update_velocity(m, pos, v, n, i);
+                       std::vector<Velocity>& v, const size_t n, const int thread, int& batch) {
+    for_each_chunk(thread, batch, [&](size_t, const size_t begin, const size_t end) {
+        bodies.load_positions(pos, begin, end);
+    });
+    inner_barrier.wait();
+
+    // every pair once, into the buffer of the chunk of rows, see accumulate_forces(); rows
+    // get shorter, idle threads steal the remaining chunks. A chunk is added into the same
+    // buffer whichever thread takes it, so the sums do not depend on the timing
+    for_each_chunk(thread, batch, [&](const size_t chunk, const size_t begin, const size_t end) {
+        forces[chunk].clear(n);
+        accumulate_forces(bodies, forces[chunk], begin, end);
+    });
+    inner_barrier.wait();
+
+    // sum the buffers, always in the order of the chunks
+    for_each_chunk(thread, batch, [&](size_t, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Force total{};
+            // chunks of later rows add nothing to body i
+            for (size_t chunk = 0; chunk < n_chunks && n * chunk / n_chunks <= i; ++chunk) {
+                total += forces[chunk][i];
+            }
+            // v += at
+            v[i] += (total / m[i]) * DT;
+        }
+    });
+}
+
+void update_velocities(BarnesHut& tree, const std::vector<double>& m,
+                       const std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n,
+                       const int thread, int& batch) {
+    // thread 0 splits the top of the tree, all threads build the subtrees
+    if (thread == 0) {
+        tree.build_top(m, pos, n);
+        next_cell = 0;
     }
+    inner_barrier.wait();
+    for (size_t cell = next_cell++; cell < tree.n_cells(); cell = next_cell++) {
+        tree.build_cell(cell);
+    }
+    inner_barrier.wait();
+    if (thread == 0) tree.build_finish();
+    inner_barrier.wait();
+
+    for_each_chunk(thread, batch, [&](size_t, const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            update_velocity(tree, m, v, i, theta);
+        }
+    });
 }
 
 void* worker(void* args) {
-    const auto [begin, end, n_iterations] = *static_cast<Args*>(args);
+    const auto [first, n_iterations, thread] = *static_cast<Args*>(args);
+    int batch = 0;
     // waiting for a start signal
-    for (int i = 0; i < n_iterations; ++i) {
-        update_velocities(m, pos, v, n_body, begin, end);
-        pthread_barrier_wait(&inner_barrier);
-        update_positions(m, pos, v, n_body, begin, end);
-        pthread_barrier_wait(&barrier);
+    for (int i = first; i < n_iterations; ++i) {
+        if (force_engine == ForceEngine::BarnesHut) {
+            update_velocities(tree, m, pos, v, n_body, thread, batch);
+        }
+        else {
+            update_velocities(m, pos, v, n_body, thread, batch);
+        }
+        inner_barrier.wait();
+        if (collision_engine == CollisionEngine::Grid) {
+            update_positions(grid, m, pos, v, thread, batch);
+        }
+        else {
+            update_positions(m, pos, v, n_body, thread, batch);
+        }
+        barrier.wait();
+        // hold still while the master copies the state
+        if (checkpoint_due(i + 1)) barrier.wait();
     }
     pthread_exit(nullptr);
     return nullptr;
@@ -61,21 +189,34 @@ void* worker(void* args) {
 void master() {
     using namespace std::chrono;
 
-    generate_data(m, pos, v, n_body);
+    int first = 0;
+    if (!restart_path.empty()) {
+        first = load_checkpoint(restart_path, m, pos, v);
+    }
+    else if (!input_path.empty()) {
+        load_bodies(input_path, m, pos, v);
+    }
+    else {
+        generate_data(m, pos, v, n_body);
+    }
+    bodies.load_masses(m, n_body);
 
-    pthread_barrier_init(&inner_barrier, nullptr, n_thd);
-    pthread_barrier_init(&barrier, nullptr, n_thd + 1);
+    inner_barrier.init(n_thd);
+    barrier.init(n_thd + 1);
 
-    std::vector<int> counts(n_thd);
-    std::vector<int> displs(n_thd + 1);
-    split_data(counts, displs, n_body, n_thd);
+    n_chunks = std::max(std::min(n_body, CHUNKS_PER_THREAD * n_thd), 1);
+    tasks[0].resize(n_chunks, n_thd);
+    tasks[1].resize(n_chunks, n_thd);
+    grid.resize(n_body, n_chunks);
+    collisions.resize(n_chunks);
+    forces.resize(n_chunks);
 
     // initialize thread args
     std::vector<Args> args(n_thd);
     for (size_t i = 0; i < n_thd; ++i) {
-        args[i].begin = displs[i];
-        args[i].end = displs[i + 1];
+        args[i].first = first;
         args[i].n_iterations = n_iteration;
+        args[i].thread = i;
     }
 
     // create threads
@@ -84,17 +225,23 @@ void master() {
         pthread_create(&threads[i], nullptr, worker, &args[i]);
     }
 
-    for (int i = 0; i < n_iteration; i++) {
+    CheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; i++) {
         high_resolution_clock::time_point t1 = high_resolution_clock::now();
 
         // a new iteration begins when every threads reach the barrier
-        pthread_barrier_wait(&barrier);
+        barrier.wait();
 
         high_resolution_clock::time_point t2 = high_resolution_clock::now();
         duration<double> time_span = t2 - t1;
 
         std::cout << "Iteration " << i << ", elapsed time: " << time_span.count() << '\n';
 
+        if (checkpoint_due(i + 1)) {
+            checkpoints.save(i + 1, m, pos, v);
+            barrier.wait();
+        }
+
 #ifdef GUI
         glut_update();
 #endif
@@ -104,19 +251,16 @@ void master() {
     for (const pthread_t& thread : threads) {
         pthread_join(thread, nullptr);
     }
-
-    pthread_mutex_destroy(&data_mutex);
-    pthread_barrier_destroy(&inner_barrier);
-    pthread_barrier_destroy(&barrier);
 }
 
 
 int main(int argc, char* argv[]) {
     const std::string prog_name = "Pthreads";
 
-    n_body = std::stoi(argv[1]);
-    n_iteration = std::stoi(argv[2]);
-    n_thd = std::stoi(argv[3]);
+    const std::vector<char*> params = parse_args(argc, argv);
+    n_body = std::stoi(params[0]);
+    n_iteration = std::stoi(params[1]);
+    n_thd = std::stoi(params[2]);
 
 #ifdef GUI
     glut_init(argc, argv, prog_name);
@@ -1,49 +1,160 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <utility>
 
+#include "barnes_hut.h"
+#include "bodies.h"
+#include "checkpoint.h"
+#include "collision_grid.h"
+#include "collisions.h"
 #include "common.h"
 
+BarnesHut tree;
+CollisionGrid grid;
+Collisions collisions;
+Bodies bodies;
+Forces forces;
+
+// --validate: the same run in double precision, see in_double_precision()
+std::vector<Point> pos_double;
+std::vector<Velocity> v_double;
+Bodies bodies_double;
+
 void update_positions(const std::vector<double>& m, std::vector<Point>& pos,
                       std::vector<Velocity>& v, const size_t n) {
+    // move all bodies first, then look for collisions among all pairs, see collisions.h
+    for (size_t i = 0; i < n; i++) {
+        move_body(pos, v, i);
+    }
+    collisions.detect(pos, n, 0, 0, n);
+    collisions.resolve(m, pos, v, 0);
+}
+
+void update_positions(CollisionGrid& grid, const std::vector<double>& m,
+                      std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n) {
+    // move all bodies first, then look for collisions around each one
     for (size_t i = 0; i < n; i++) {
-        update_position(m, pos, v, n, i);
+        move_body(pos, v, i);
     }
+    grid.build(pos, n);
+    collisions.detect(grid, pos, 0, 0, n);
+    collisions.resolve(m, pos, v, 0);
 }
 
 void update_velocities(const std::vector<double>& m, const std::vector<Point>& pos,
                        std::vector<Velocity>& v, const size_t n) {
+    // every pair once, see accumulate_forces()
+    bodies.load_positions(pos, 0, n);
+    forces.clear(n);
+    accumulate_forces(bodies, forces, 0, n);
+    for (size_t i = 0; i < n; i++) {
+        // v += at
+        v[i] += (forces[i] / m[i]) * DT;
+    }
+}
+
+void update_velocities(BarnesHut& tree, const std::vector<double>& m,
+                       const std::vector<Point>& pos, std::vector<Velocity>& v, const size_t n) {
+    tree.build(m, pos, n);
     for (size_t i = 0; i < n; i++) {
-        update_velocity(m, pos, v, n, i);
+        update_velocity(tree, m, v, i, theta);
     }
 }
 
+void do_one_iteration() {
+    if (force_engine == ForceEngine::BarnesHut) {
+        update_velocities(tree, m, pos, v, n_body);
+    }
+    else {
+        update_velocities(m, pos, v, n_body);
+    }
+    if (collision_engine == CollisionEngine::Grid) {
+        update_positions(grid, m, pos, v, n_body);
+    }
+    else {
+        update_positions(m, pos, v, n_body);
+    }
+}
+
+template <typename Step>
+void in_double_precision(Step step) {
+    // the steps work on the globals, swap the double precision run in for this one
+    const Precision chosen = precision;
+    precision = Precision::Double;
+    std::swap(pos, pos_double);
+    std::swap(v, v_double);
+    std::swap(bodies, bodies_double);
+    step();
+    std::swap(pos, pos_double);
+    std::swap(v, v_double);
+    std::swap(bodies, bodies_double);
+    precision = chosen;
+}
+
+void report_drift() {
+    // distance of each body from where the double precision run has it
+    double max_drift = 0, sum_sqr = 0;
+    for (int i = 0; i < n_body; i++) {
+        const double sqr = pos[i].sqr_dist(pos_double[i]);
+        max_drift = std::max(max_drift, std::sqrt(sqr));
+        sum_sqr += sqr;
+    }
+    std::cout << "Drift from double precision: max " << max_drift << ", rms "
+              << std::sqrt(sum_sqr / n_body) << '\n';
+}
+
 void master() {
     using namespace std::chrono;
 
-    generate_data(m, pos, v, n_body);
+    int first = 0;
+    if (!restart_path.empty()) {
+        first = load_checkpoint(restart_path, m, pos, v);
+    }
+    else if (!input_path.empty()) {
+        load_bodies(input_path, m, pos, v);
+    }
+    else {
+        generate_data(m, pos, v, n_body);
+    }
+    bodies.load_masses(m, n_body);
+    collisions.resize(1);
+    if (validate) {
+        pos_double = pos;
+        v_double = v;
+        in_double_precision([] { bodies.load_masses(m, n_body); });
+    }
 
-    for (int i = 0; i < n_iteration; i++) {
+    CheckpointWriter checkpoints;
+    for (int i = first; i < n_iteration; i++) {
         high_resolution_clock::time_point t1 = high_resolution_clock::now();
 
-        update_velocities(m, pos, v, n_body);
-        update_positions(m, pos, v, n_body);
+        do_one_iteration();
 
         high_resolution_clock::time_point t2 = high_resolution_clock::now();
         duration<double> time_span = t2 - t1;
 
         std::cout << "Iteration " << i << ", elapsed time: " << time_span.count() << '\n';
 
+        // the reference run is not timed
+        if (validate) in_double_precision(do_one_iteration);
+
+        if (checkpoint_due(i + 1)) checkpoints.save(i + 1, m, pos, v);
+
 #ifdef GUI
         glut_update();
 #endif
     }
+    if (validate) report_drift();
 }
 
 int main(int argc, char* argv[]) {
     const std::string prog_name = "Sequential";
     
-    n_body = std::stoi(argv[1]);
-    n_iteration = std::stoi(argv[2]);
+    const std::vector<char*> params = parse_args(argc, argv);
+    n_body = std::stoi(params[0]);
+    n_iteration = std::stoi(params[1]);
 
 #ifdef GUI
     glut_init(argc, argv, prog_name);
@@ -0,0 +1,111 @@
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace {
+
+// checks of the sense before a waiting thread goes to sleep
+constexpr int SPIN_LIMIT = 2000;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+void sleep_while(std::atomic<uint32_t>& word, const uint32_t value) {
+    // return once word != value, spurious wake-ups are checked by the caller
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, value, nullptr,
+            nullptr, 0);
+#else
+    if (word.load() == value) std::this_thread::yield();
+#endif
+}
+
+void wake_all(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr,
+            nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+inline uint64_t pack(const uint64_t front, const uint64_t back) {
+    return front | back << 32;
+}
+
+}  // namespace
+
+void SpinBarrier::init(const int count) {
+    this->count = count;
+    remaining.store(count);
+    // with more threads than cores the thread being waited for may need the core of a spinning one
+    const unsigned int cores = std::thread::hardware_concurrency();
+    spin_limit = cores == 0 || static_cast<unsigned int>(count) <= cores ? SPIN_LIMIT : 0;
+}
+
+void SpinBarrier::wait() {
+    const uint32_t current = sense.load();
+    if (remaining.fetch_sub(1) == 1) {
+        // the last thread resets the count for the next use and releases the others
+        remaining.store(count);
+        sense.store(current + 1);
+        if (sleepers.load() > 0) wake_all(sense);
+        return;
+    }
+
+    for (int spin = 0; spin < spin_limit; ++spin) {
+        if (sense.load() != current) return;
+        cpu_relax();
+    }
+    // announce the sleep before the last check, so that the last thread sees it
+    sleepers.fetch_add(1);
+    while (sense.load() == current) sleep_while(sense, current);
+    sleepers.fetch_sub(1);
+}
+
+void ChunkQueues::resize(const size_t n_chunks, const int n_threads) {
+    chunks = n_chunks;
+    threads = n_threads;
+    shares.reset(new Share[n_threads]);
+    for (int thread = 0; thread < n_threads; ++thread) refill(thread);
+}
+
+void ChunkQueues::refill(const int thread) {
+    const uint64_t front = chunks * thread / threads;
+    const uint64_t back = chunks * (thread + 1) / threads;
+    shares[thread].range.store(pack(front, back));
+}
+
+bool ChunkQueues::pop(const int thread, size_t& chunk) {
+    if (take(shares[thread], true, chunk)) return true;
+    for (int i = 1; i < threads; ++i) {
+        if (take(shares[(thread + i) % threads], false, chunk)) return true;
+    }
+    return false;
+}
+
+bool ChunkQueues::take(Share& share, const bool front, size_t& chunk) {
+    uint64_t range = share.range.load();
+    while (true) {
+        const uint64_t first = range & 0xffffffff, last = range >> 32;
+        if (first >= last) return false;
+        const uint64_t taken = front ? pack(first + 1, last) : pack(first, last - 1);
+        // on failure range is reloaded and the share is looked at again
+        if (share.range.compare_exchange_weak(range, taken)) {
+            chunk = front ? first : last - 1;
+            return true;
+        }
+    }
+}
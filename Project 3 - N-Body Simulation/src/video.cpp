@@ -11,6 +11,10 @@
 #include <fstream>
 #include <iomanip>
 #include <string>
+#include <cstring>
+#include <vector>
+
+#include "logger.h"
 
 
 int n_body;
@@ -21,22 +25,29 @@ std::string version;
 
 
 int main(int argc, char *argv[]){
+    // frames written by Logger, see logger.h
     std::string path = argv[1];
-    std::string meta_path = path + "/" + "metadata.txt";
-    std::cout << "metadata path: " << meta_path << std::endl;
-    std::ifstream f(meta_path);
-    f >> version;
-    f >> n_body;
-    f >> bound_x;
-    f >> bound_y;
-    f >> n_iteration;
+    std::string data_path = path + "/" + "frames.bin";
+    std::cout << "data path: " << data_path << std::endl;
+    std::ifstream df(data_path, std::ios::binary | std::ios::ate);
+    const std::streamoff file_bytes = df.tellg();
+    df.seekg(0);
+    FrameHeader header{};
+    df.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!df || std::memcmp(header.magic, FRAME_MAGIC, sizeof(header.magic)) != 0) {
+        std::cout << data_path << " is not a frame file" << std::endl;
+        return 1;
+    }
+    version = std::string(header.version, strnlen(header.version, sizeof(header.version)));
+    n_body = header.n_body;
+    bound_x = header.x_bound;
+    bound_y = header.y_bound;
+    const size_t frame_bytes = 2 * static_cast<size_t>(n_body) * header.scalar_bytes;
+    // a frame still being written is left out
+    n_iteration = frame_bytes > 0 ? (file_bytes - sizeof(header)) / frame_bytes : 0;
     std::cout << "version: " << version;
     std::cout << "n_body: " << n_body;
     std::cout << "n_iteration: " << n_iteration;
-    f.close();
-
-    std::string data_path = path + "/" + "data.txt";
-    std::ifstream df(data_path);
 
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
@@ -51,14 +62,24 @@ int main(int argc, char *argv[]){
     double* y = new double[n_body];
     double* vx = new double[n_body];
     double* vy = new double[n_body];
+    std::vector<unsigned char> frame(frame_bytes);
 
     for (int i = 0; i < n_iteration; i++){
 
         std::cout << "Iteration " << i << std::endl;
 
+        df.read(reinterpret_cast<char*>(frame.data()), frame_bytes);
         for (int i = 0; i < n_body; i++){
-            df >> x[i];
-            df >> y[i];
+            if (header.scalar_bytes == sizeof(float)) {
+                float xy[2];
+                std::memcpy(&xy[0], &frame[i * sizeof(float)], sizeof(float));
+                std::memcpy(&xy[1], &frame[(n_body + i) * sizeof(float)], sizeof(float));
+                x[i] = xy[0];
+                y[i] = xy[1];
+            } else {
+                std::memcpy(&x[i], &frame[i * sizeof(double)], sizeof(double));
+                std::memcpy(&y[i], &frame[(n_body + i) * sizeof(double)], sizeof(double));
+            }
         }
 
         glClear(GL_COLOR_BUFFER_BIT);